@@ -0,0 +1,113 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- lists the hottest paths of every path profiled function in a binary profile (CS201ProfileRuntime.c) as
+ * block sequences, decoded from the path numbering DAG the pass stores with the counts (part 4 of ball larus):
+ *
+ *   c++ CS201PathDecoder.cpp -o cs201-paths -lrt
+ *   cs201-paths [-k K] [cs201.prof | --shm /name]
+ *
+ * A path that starts or ends at a back edge (or a loop region boundary) is shown with "..." on that side.
+ */
+
+#include "CS201ProfileReader.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//CS201 Helper Function - the blocks of path p as text, "?" if p is not a path of the function
+static string describePath(const CS201ProfileModule &m, const cs201_profile_function &function, const CS201PathDecoder &decoder, uint64_t p){
+	vector<uint32_t> blocks;
+	bool afterCut, beforeCut;
+	if(!decoder.decode(p, blocks, afterCut, beforeCut))
+		return "?";
+
+	string text = afterCut ? "... " : "";
+	for(size_t i = 0; i < blocks.size(); i++){
+		if(i != 0)
+			text += " -> ";
+		text += m.nameAt(m.blockNames[function.blockNames + blocks[i]]);
+	}
+	if(beforeCut)
+		text += " ...";
+	return text;
+}
+
+//CS201 Helper Function - prints the 'k' hottest paths of every function in the module record at 'pos', returns the position of the next one (0 on a malformed record)
+static size_t printModule(const vector<char> &data, size_t pos, size_t k){
+	CS201ProfileModule m;
+	string error;
+	size_t end = readProfileModule(data, pos, m, error);
+	if(end == 0){
+		cerr << "cs201-paths: " << error << "\n";
+		return 0;
+	}
+
+	for(uint32_t f = 0; f < m.functions.size(); f++){
+		const cs201_profile_function &function = m.functions[f];
+		if(function.numDagEdges == 0)
+			continue;
+
+		vector<pair<uint64_t, uint64_t> > taken;
+		uint64_t lost;
+		takenPaths(m, function, taken, lost);
+		uint64_t total = lost;
+		for(size_t i = 0; i < taken.size(); i++){
+			total += taken[i].second;
+		}
+
+		string name = m.nameAt(function.name);
+		cout << "Function " << name << ": " << taken.size() << " of " << function.numPaths << " paths taken, " << total << " times\n";
+
+		size_t shown = min(k, taken.size());
+		sortHottest(taken, shown);
+		CS201PathDecoder decoder(m, function);
+		for(size_t i = 0; i < shown; i++){
+			cout << "Path_" << name << "_" << taken[i].first << ": " << taken[i].second << "  " << describePath(m, function, decoder, taken[i].first) << "\n";
+		}
+		if(lost != 0)
+			cout << "Path_" << name << "_other: " << lost << "  (path table full)\n";
+		cout << "\n";
+	}
+	return end;
+}
+
+int main(int argc, char **argv){
+	size_t k = 10;
+	const char *path = "cs201.prof";
+	const char *shm = NULL;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		if(arg == "-k" && i + 1 < argc){
+			k = strtoul(argv[++i], NULL, 10);
+		}else if(arg == "--shm" && i + 1 < argc){
+			shm = argv[++i];
+		}else{
+			path = argv[i];
+		}
+	}
+
+	vector<char> data;
+	string error;
+	if(shm && !readShmProfile(shm, data, error)){
+		cerr << "cs201-paths: " << error << "\n";
+		return 1;
+	}
+	if(!shm && !readProfileFile(path, data)){
+		cerr << "cs201-paths: can not read " << path << "\n";
+		return 1;
+	}
+
+	//one record per instrumented module
+	size_t pos = 0;
+	while(pos < data.size()){
+		pos = printModule(data, pos, k);
+		if(pos == 0)
+			return 1;
+	}
+	return 0;
+}
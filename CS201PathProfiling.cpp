@@ -16,559 +16,362 @@
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Support/GenericDomTree.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "CS201Profile.h"
+#include "CS201ProfileReader.h"
 #include <iostream>
 #include <string>
 #include <vector>
-#include <stack>
 #include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <set>
 
 using namespace llvm;
 using namespace std;
 
+// CS201 --- dominator sets are a debugging aid, only computed when asked for
+static cl::opt<bool> PrintDomSets("path-profiling-dom-sets", cl::desc("Print the dominator set of every basic block"), cl::init(false));
+
+// CS201 --- how the instrumented program updates its counters
+enum CounterMode { CM_PLAIN, CM_ATOMIC, CM_TLS, CM_SHARDED };
+static cl::opt<CounterMode> CounterUpdates("path-profiling-counters", cl::desc("How counters are updated at run time"), cl::init(CM_PLAIN),
+	cl::values(clEnumValN(CM_PLAIN, "plain", "load/add/store, single threaded programs only"),
+			   clEnumValN(CM_ATOMIC, "atomic", "relaxed atomicrmw add on the shared counters"),
+			   clEnumValN(CM_TLS, "tls", "per-thread counters merged at thread exit (link CS201ProfileRuntime.c)"),
+			   clEnumValN(CM_SHARDED, "sharded", "relaxed atomic add on one of several cache line aligned copies picked per thread"),
+			   clEnumValEnd));
+
+// CS201 --- which edges edge profiling counts, the profile tool recovers the others
+enum EdgeProfileMode { EP_CHORDS, EP_ALL, EP_VALIDATE };
+static cl::opt<EdgeProfileMode> EdgeProfiling("path-profiling-edges", cl::desc("Edges counted by edge profiling"), cl::init(EP_CHORDS),
+	cl::values(clEnumValN(EP_CHORDS, "chords", "only the chords of a spanning tree of the CFG, the rest follows from flow conservation"),
+			   clEnumValN(EP_ALL, "all", "every branch edge"),
+			   clEnumValN(EP_VALIDATE, "validate", "chords and every branch edge, the profile tool checks the recovered counts"),
+			   clEnumValEnd));
+
+static cl::opt<bool> SaturateCounters("path-profiling-saturate", cl::desc("Counters stop at their maximum instead of wrapping (plain and tls counters)"), cl::init(false));
+
+// CS201 --- spanning trees keep the most frequent edges, so counters land on cold ones
+static cl::opt<string> EdgeWeightsFile("path-profiling-weights", cl::desc("Profile of an earlier run giving the edge frequencies (default: static estimate)"), cl::value_desc("filename"), cl::init(""));
+
+// CS201 --- profile use: instead of instrumenting, branches get the branch weights of an earlier run (matched by function
+// name and CFG hash) and functions their entry counts, for the optimisations that follow
+static cl::opt<string> ProfileUseFile("path-profiling-use", cl::desc("Annotate branches with the counts of this profile instead of instrumenting"), cl::value_desc("filename"), cl::init(""));
+
+// CS201 --- superblocks (with -path-profiling-use): the hottest paths of a function are decoded from the profile and tail
+// duplicated from their first side entrance on, so each one is entered only at its top and later passes can optimise along it
+static cl::opt<unsigned> SuperblockPaths("path-profiling-superblocks", cl::desc("With -path-profiling-use, tail duplicate the N hottest paths of every function into superblocks"), cl::init(0));
+static const unsigned int SuperblockMaxInstrs = 128; //most instructions duplicated for one path
+
+// CS201 --- functions are analysed in parallel, only adding the instrumentation is done one function at a time
+static cl::opt<unsigned> AnalysisThreads("path-profiling-threads", cl::desc("Threads analysing functions (0: one per core)"), cl::init(0));
+
+// CS201 --- functions with more paths than this count them in a path table (hash table, CS201Profile.h) instead of a counter each
+static cl::opt<unsigned> PathTableThreshold("path-profiling-table-threshold", cl::desc("Most paths a function counts in a counter per path"), cl::init(1 << 16));
+static cl::opt<unsigned> PathTableSlots("path-profiling-table-slots", cl::desc("Slots in the path table of a function, rounded up to a power of two"), cl::init(4096));
+
+// CS201 --- innermost loops as regions of their own: every edge into or out of one ends the path like a back edge does, so a
+// region's paths all start at its header and are counted in locals of the function, added to the counters when the loop is left.
+// Counts of a loop left by exit(), longjmp or an exception thrown by a call are lost
+static cl::opt<bool> LoopRegions("path-profiling-loop-regions", cl::desc("Count the paths of innermost loops on their own, in locals flushed when the loop is left"), cl::init(false));
+//the local counts are an array indexed by the path register, which stays in memory, and leaving the loop flushes every slot of it,
+//reached or not: that only pays off over the shared counters for regions with a handful of paths. Larger ones still get their own
+//numbering, but count in the function's counters
+static const int64_t LoopRegionMaxPaths = 4;
+
+// CS201 --- which functions are instrumented: every one, or the ones a regex or a list names, and none with fewer blocks than asked for
+static cl::opt<string> FunctionRegex("path-profiling-functions", cl::desc("Only instrument functions whose name matches this regex"), cl::value_desc("regex"), cl::init(""));
+static cl::opt<string> FunctionListFile("path-profiling-function-list", cl::desc("Only instrument the functions named in this file, one per line"), cl::value_desc("filename"), cl::init(""));
+static cl::opt<unsigned> MinBlocks("path-profiling-min-blocks", cl::desc("Do not instrument functions with fewer basic blocks"), cl::init(1));
+
+// CS201 --- sampling (Arnold-Ryder): an instrumented clone of the function runs on one call in N, picked by a per-thread
+// countdown, and the original runs on the others. The counts then only cover the sampled calls. Functions that can not be cloned
+// (varargs, inalloca arguments, blocks whose address is taken) are instrumented in place and count every call
+static cl::opt<unsigned> SampleInterval("path-profiling-sample", cl::desc("Run the instrumented copy of a function on one call in N (1: every call; functions with varargs, inalloca or address-taken blocks are always instrumented)"), cl::init(1));
+
+static const double LoopTripEstimate = 10; //assumed iterations of every loop
+static const unsigned int MaxWeightedLoopDepth = 16; //deeper blocks weigh as much as this deep ones, so weights stay finite
+static const double LoopStayWeight = 7; //an edge staying in a loop is taken 7 times as often as one leaving it
+static const double UnreachableWeight = 1.0 / 1024; //edges into blocks ending in 'unreachable' are almost never taken
+
+// CS201 --- switches with at least this many cases, spanning at most SwitchTableDensity values per case, add their path
+// register increments through a table indexed by the case
+static const unsigned int SwitchTableMinCases = 8;
+static const unsigned int SwitchTableDensity = 4;
+
+static const unsigned int NumCounterShards = 16; //must be a power of two
+static const unsigned int CounterLineSize = 64; //bytes in a cache line
+static const unsigned int CountersPerLine = CounterLineSize / 8; //i64 counters in a cache line
+
 // CS201 --- how we represent our edges
 struct Edge{
 	BasicBlock *base;
 	BasicBlock *end;
-	int value;
+	int64_t value;
+	unsigned succ; //successor number of 'end' in the terminator of 'base' (real CFG edges only)
 };
 
-vector<BasicBlock*> BBList; //maintain inorder list of basic blocks (per function)
-vector<Edge> edges; //vector of edges (per function)
-vector<Edge> old_edges;
-vector<vector<BasicBlock*>> loops; //will hold all the loops found in the function
-
-namespace {
+// CS201 --- instrumentation placed on an edge by part 3 of ball larus
+enum RegInstr { R_NONE, R_SET, R_ADD }; // 'r=Inc(e)', 'r+=Inc(e)'
+enum MemInstr { M_NONE, M_COUNT_R, M_COUNT_CONST }; // 'count[r+Inc(e)]++', 'count[Inc(e)]++'
 
-  static Function* printf_prototype(LLVMContext& ctx, Module *mod){
-    vector<Type*> printf_arg_types;
-	printf_arg_types.push_back(Type::getInt8PtrTy(ctx));
+// CS201 --- disjoint sets over dense block numbers (path compression + union by rank), used to build the spanning tree
+struct DisjointSet{
+	vector<unsigned> parent;
+	vector<unsigned> rank;
 
-	FunctionType* printf_type = FunctionType::get(Type::getInt32Ty(ctx), printf_arg_types, true);
-	Function *func = mod->getFunction("printf");
-	if(!func){
-	  func = Function::Create(printf_type, Function::ExternalLinkage, Twine("printf"), mod);
+	DisjointSet(unsigned n) : parent(n), rank(n, 0) {
+		for(unsigned i = 0; i < n; i++){
+			parent[i] = i;
+		}
 	}
-	func->setCallingConv(CallingConv::C);
-	return func;
-  }
-
-  struct CS201PathProfiling : public FunctionPass {
-    static char ID;
-    LLVMContext *Context;
-    CS201PathProfiling() : FunctionPass(ID) {}
-    GlobalVariable *bbCounter = NULL; // CS201 --- This is were we declare the global variables that will count the edges and paths
-    GlobalVariable *BasicBlockPrintfFormatStr = NULL; // " "
-	GlobalVariable *EdgeProfilePrintfFormatStr = NULL;
-	vector<GlobalVariable*> edgeCounters; //for edge profiliing
-	GlobalVariable* r = NULL;
-	//vector<GlobalVariable*> R; //for path profiling instrumentation	
-	vector<GlobalVariable*> pathCounters; //for path profiling
-
-    Function *printf_func = NULL;
 
-    //---------------------------------- CS201 --- This function is run once at the beginning of execution. We just initialize our variables/structures here.
-    bool doInitialization(Module &M) {
-	  errs() << "\n----------Starting Path Profiling----------------\n";
-	  Context = &M.getContext();
-	
-	  for(auto &F : M){
-		for(auto &BB : F){
-			for(auto &I : BB){
-				TerminatorInst *TI = BB.getTerminator();
-				for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
-					SplitCriticalEdge(TI, i, this);		
-				}		
-
-				if(isa<BranchInst>(I)){
-
-					for(unsigned int i = 0; i < cast<BranchInst>(I).getNumSuccessors(); i++){
-						edgeCounters.push_back(new GlobalVariable(M, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "edgeCounter"));
-						Edge edge{&BB, cast<BranchInst>(I).getSuccessor(i), 0};
-						edges.push_back(edge);
-					}	
-				}
-			}
+	unsigned find(unsigned x){
+		while(parent[x] != x){
+			parent[x] = parent[parent[x]];
+			x = parent[x];
 		}
-	  }	
+		return x;
+	}
 
-	  //errs() << edgeCounters.size() << "\n";
-	  //old_edges = edges;	
+	//returns false if a and b were already in the same set
+	bool merge(unsigned a, unsigned b){
+		a = find(a);
+		b = find(b);
+		if(a == b)
+			return false;
+
+		if(rank[a] < rank[b])
+			swap(a, b);
+		parent[b] = a;
+		if(rank[a] == rank[b])
+			rank[a]++;
+		return true;
+	}
+};
+// CS201 --- edge counts of a function from an earlier run (-path-profiling-weights)
+struct PriorEdges{
+	unsigned int numBlocks;
+	uint64_t cfgHash; //only used for a function with the same CFG
+	unsigned int sampleInterval; //the counts cover one call in this many
+	DenseMap<uint64_t, uint64_t> count; //(src << 32 | dst) -> count, dst numBlocks is EXIT. Edges whose count is not known are missing
+	vector<vector<uint32_t> > hotPaths; //blocks of the hottest paths, hottest first (-path-profiling-superblocks)
+};
 
-	  bbCounter = new GlobalVariable(M, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "bbCounter");
-	  //const char *finalPrintString = "BB Count: %d\n";
-	  const char *finalPrintString = "Edge Counter: %d\n"; 
+//CS201 Helper Function - false if 'base -> end' is a critical edge that can not be split (indirectbr), code for it has no place
+static bool canInstrumentEdge(BasicBlock* base, BasicBlock* end){
+	return base->getTerminator()->getNumSuccessors() == 1 || end->getSinglePredecessor() == base || !isa<IndirectBrInst>(base->getTerminator());
+}
 
-	  Constant *format_const = ConstantDataArray::getString(*Context, finalPrintString);
-	  BasicBlockPrintfFormatStr = new GlobalVariable(M, llvm::ArrayType::get(llvm::IntegerType::get(*Context, 8), strlen(finalPrintString)+1), true, llvm::GlobalValue::PrivateLinkage, format_const, "BasicBlockPrintfFormatStr");
-	  printf_func = printf_prototype(*Context, &M);
-	
-      return true;
-    }
+//CS201 Helper Function - FNV-1a hash of a function name, identifies the function in the profile
+static uint64_t hashName(StringRef name){
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(unsigned int i = 0; i < name.size(); i++){
+		hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
 
-    //---------------------------------- CS201 --- This function is run once at the end of execution.
-    bool doFinalization(Module &M) {
-	  errs() << "-----------Finished Path Profiling-------------------\n";
-      return false;
-    }
+//CS201 Helper Function - continues an FNV-1a hash with the bytes of 'value'
+static uint64_t hashValue(uint64_t hash, uint64_t value){
+	for(unsigned int i = 0; i < 8; i++){
+		hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+	}
+	return hash;
+}
 
+// CS201 --- state and analysis of one function. analyze() only reads the IR (its output goes to 'log'), so the
+// functions of a module are analysed in parallel and the pass instruments them afterwards, one at a time
+struct FunctionContext{
+	Function *F;
+	string name; //name of F in the output and the profile (the original's for a sampled clone)
+	unsigned int sampleInterval = 1; //calls of the original per call of F, above 1 for a sampled clone
+	const map<uint64_t, PriorEdges> &priorProfiles;
+	PriorEdges const *priorProfile = NULL; //F's edge counts of an earlier run, NULL if the static estimate is used
+
+	vector<BasicBlock*> BBList; //maintain inorder list of basic blocks
+	DenseMap<BasicBlock*, unsigned> BBIndex; //position of each block in BBList
+	uint64_t cfgHash = 0; //hash of the CFG as it was before instrumentation, see computeCfgHash
+	vector<Edge> edges; //vector of edges
+	vector<unsigned> succStart, succEdges; //CSR adjacency of 'edges': outgoing edge indices of BBList[v] are succEdges[succStart[v] .. succStart[v+1])
+	vector<unsigned> predStart, predEdges; //same layout for the incoming edge indices
+	LoopInfoBase<BasicBlock, Loop> loopInfo; //loop forest of the function: innermost loop and loop depth of each block, O(1) membership
+	vector<Loop*> loops; //every loop of the function, by header position in BBList
+	vector<double> blockFreq; //estimated executions of BBList[v] per call of the function
+	vector<unsigned> topoOrder; //blocks of the path profiling DAG in topological order
+	vector<uint64_t> treePotential; //potential of BBList[v] in the path profiling spanning tree, see computeTreePotentials
+
+	//edge profiling: CFG edges in block and successor order (a NULL end is EXIT), and which are chords of its spanning tree
+	vector<Edge> cfgEdges;
+	vector<bool> cfgChord;
+	SmallPtrSet<Loop*, 8> accumulatorLoops; //loops whose edge counts are kept in locals while they run, see findAccumulatorLoops
+
+	//path profiling, only filled in if 'pathProfiled'
+	bool pathProfiled = false;
+	BasicBlock *entry = NULL; //ENTRY of the DAG, EXIT is virtual: vertex BBList.size(), a NULL end (or base) of an edge
+	vector<Edge> cutEdges; //edges left out of the DAG: the back edges, and the edges into and out of loop regions
+	unsigned int numDAGEdges = 0; //edges[0, numDAGEdges) are real CFG edges, the rest are dummies
+	vector<int> entryDummy; //index of the ENTRY -> target dummy edge of cutEdges[i], shared by the cut edges with the same target
+	vector<int> exitDummy; //index of the source -> EXIT dummy edge of cutEdges[i]
+	vector<Loop*> regions; //loop regions (-path-profiling-loop-regions)
+	vector<int> regionEntry; //index of the ENTRY -> header dummy edge of regions[i], every path of the region starts with it
+	vector<int> blockRegion; //region of BBList[v], -1 if it is in none
+	vector<int64_t> pathsFrom; //NumPaths(BBList[v]) in the DAG, EXIT last
+	vector<int> leafDummy; //index of the leaf -> EXIT dummy edges, one per block without successors
+	int64_t numPaths = 0;
+	vector<RegInstr> regInstr;
+	vector<int64_t> instrumentationR; //'r=#'
+	vector<MemInstr> memInstr;
+	vector<int64_t> instrumentationM; //'count[...]++'
+
+	string logText;
+	raw_string_ostream log; //what analyze() prints, written out when F is instrumented so the output keeps module order
+
+	FunctionContext(Function *F, const string &name, const map<uint64_t, PriorEdges> &priorProfiles) : F(F), name(name), priorProfiles(priorProfiles), log(logText) {}
 
  	//CS201 Helper function to print edges with Ball_Laurus value
 	void printEdge(Edge &e){
-		errs() << "(";
-		e.base->printAsOperand(errs(), false);
-		errs() << ",";
-		e.end->printAsOperand(errs(), false);
-		errs() << "," << e.value;
-		errs() << ")"; 
+		log << "(";
+		printVertex(e.base);
+		log << ",";
+		printVertex(e.end);
+		log << "," << e.value;
+		log << ")"; 
 	}
  
-	//CS201 Helper Function to compute Maximal Spanning Tree
-	vector<Edge> computeMST(vector<Edge> &edges){
-		vector<Edge> MST; // will hold the maximal spanning tree
-		vector<BasicBlock*> MSTbb; //vertices of MST
-
-		vector<Edge> S = edges; //S
-
-		int maxVal;
-		int index;
-		bool addEdge = true;
-		while(MSTbb != BBList){
-			//travers S to find edge of maximal value
-			if(S.empty())
-				break;
-
-			//errs() << "Check on size of S: " << S.size() << "\n";
-			for(unsigned int i = 0; i < S.size(); i++){
-				if(i == 0){
-					maxVal = S[i].value;
-					index = i;
-					continue;
-				}
-					
-				if(S[i].value > maxVal){
-					maxVal = S[i].value;
-					index = i;
-				}
-			}
-			//after previous loop, now have candidate edge in S[index]
-
-			//MST is initially empty, so add the edge and record used vertices
-			if(MST.empty()){
-				//errs() << "empty MST check\n";
-				MST.push_back(S[index]);
-				MSTbb.push_back(S[index].base);
-				MSTbb.push_back(S[index].end);
-				//remove edge from S
-				S.erase(S.begin()+index);
-				continue;
-			}else{
-				//after the first iteration, need to verify the endpoints of candidate edge not in BBList
-				//errs() << "error check\n";
-				//errs() << MSTbb.size() << "\n";
-				for(unsigned int i = 0; i < MSTbb.size(); i++){
-					//errs() << "error check2\n";
-					if(S[index].base == MSTbb[i]){
-						//errs() << "S[index].base: ";
-						//S[index].base->printAsOperand(errs(), false);
-						//errs() << "\n";
-
-						//errs() << "MSTbb[" << i << "]: ";
-						//MSTbb[i]->printAsOperand(errs(), false);
-						//errs() << "\n";
-						
-						for(unsigned int k = 0; k < MSTbb.size(); k++){
-							if(S[index].end == MSTbb[k]){
-								//edge endpoints already covered in MST, so don't add edge
-								addEdge = false;
-							}
-						}
-					}
-				}
-
-				if(addEdge){
-					//errs() << "candidate edge is:";
-					//printEdge(S[index]);
-					//errs() << "\n";				
-
-					MST.push_back(S[index]);
-					//but need to make sure we don't add the same vertex twice to MSTbb
-					
-					bool addBase = true;
-					//check S[index].base
-					for(unsigned int i = 0; i < MSTbb.size(); i++){
-						if(S[index].base == MSTbb[i]){
-							addBase = false;
-							break;
-						}
-					}
-					
-					bool addEnd = true;
-					//check S[index].end
-					for(unsigned int i = 0; i < MSTbb.size(); i++){
-						if(S[index].end == MSTbb[i]){
-							addEnd = false;
-							break;
-						}
-					}
-	
-					if(addBase){
-						MSTbb.push_back(S[index].base);
-					}
-					
-					if(addEnd){
-						MSTbb.push_back(S[index].end);
-					}
-					
-					S.erase(S.begin()+index);
-				}else{//if addEdge = false
-					S.erase(S.begin()+index);
-					addEdge = true;
-				}
-				
-			}
-		}
+	void printVertex(BasicBlock *BB){
+		if(BB)
+			BB->printAsOperand(log, false);
+		else
+			log << "EXIT";
+	}
 
-		return MST;
+	//CS201 Helper Function - DAG vertex of a block, NULL is EXIT (the vertex after the blocks)
+	unsigned vertex(BasicBlock *BB){
+		return BB ? BBIndex[BB] : BBList.size();
 	}
 
-	//CS201 Helper Function to compute path between successors of head of path and predecessors of the exit node
-	bool getPath(vector<Edge> &path, BasicBlock* succ_source, vector<BasicBlock*> &successors, BasicBlock* pred_source, vector<BasicBlock*> &predeccesors){
-		//when computing path, find edge from succ_source to pred[i]=succ[y], add it and add edge from pred[i]=succ[y] to pred_source
+	//CS201 Helper Function to build the CSR successor/predecessor edge lists of 'edges' (edge order is kept within each block)
+	void buildAdjacency(vector<Edge> &edges){
+		unsigned int n = BBList.size() + 1; //EXIT included
+		succStart.assign(n + 1, 0);
+		predStart.assign(n + 1, 0);
+		for(unsigned int i = 0; i < edges.size(); i++){
+			succStart[vertex(edges[i].base) + 1]++;
+			predStart[vertex(edges[i].end) + 1]++;
+		}
+		for(unsigned int v = 0; v < n; v++){
+			succStart[v+1] += succStart[v];
+			predStart[v+1] += predStart[v];
+		}
 
-		bool isPath = false;
-		
-		//the base case for recursion
+		succEdges.resize(edges.size());
+		predEdges.resize(edges.size());
+		vector<unsigned> succNext(succStart.begin(), succStart.end() - 1);
+		vector<unsigned> predNext(predStart.begin(), predStart.end() - 1);
 		for(unsigned int i = 0; i < edges.size(); i++){
-			//this means the path between sources is one edge, push back that one edge and return true
-			if(edges[i].base == succ_source && edges[i].end == pred_source){
-				path.push_back(edges[i]);
-				isPath = true;
-				return isPath;
-			}
+			succEdges[succNext[vertex(edges[i].base)]++] = i;
+			predEdges[predNext[vertex(edges[i].end)]++] = i;
 		}
+	}
 
+	//CS201 Helper Function to compute Maximal Spanning Tree (Kruskal over the edges sorted by weight[i], the edge's estimated frequency)
+	//'root' is the index of the EXIT->ENTRY edge, it always has to be part of the tree for the chord increments to be valid
+	//inMST[i] is set for every edges[i] that ends up in the tree, the rest are the chords
+	vector<Edge> computeMST(vector<Edge> &edges, vector<double> &weight, unsigned int root, vector<bool> &inMST){
+		vector<Edge> MST; // will hold the maximal spanning tree
 
-		//For the case when the first edge checked is the chord we're searching for a path for
-		//first iterate over exit's predeccesors
-		for(unsigned int i = 0; i < predeccesors.size(); i++){
-			for(unsigned int y = 0; y < successors.size(); y++){
-				if(predeccesors[i] == successors[y]){ // there is a direct path, create
-					isPath = true;
-					for(unsigned int g = 0; g < edges.size(); g++){
-						if(edges[g].base == succ_source && edges[g].end == predeccesors[i]){
-							//succ_source --> pred[i]
-							path.push_back(edges[g]);
-
-							//pred[i] --> pred_source
-							for(unsigned int k = 0; k < edges.size(); k++){
-								if(edges[k].base == predeccesors[i] && edges[k].end == pred_source){
-									path.push_back(edges[k]);
-									return isPath;
-									//break;
-								}
-							}
-							//break;
-						}
-				
-						//case when succ source and pred source dont share an edge
-						//source --> succ[i]
-						for(unsigned int v = 0; v < edges.size(); v++){
-							if(edges[v].base == succ_source && edges[v].end == successors[y]){
-								path.push_back(edges[v]);
-							}						
-						}
-
-						//pred[i] --> source	
-						for(unsigned int v = 0; v < edges.size(); v++){
-							if(edges[v].base == predeccesors[i] && edges[v].end == pred_source){
-								path.push_back(edges[v]);
-							}						
-						}
-						return isPath;
-					}
-					//break;
-				}
-			}
-		}
-	
-		//if there is no match predeccesors[i] == successors[y], then we need to start a new iteration
-		//successors will not chance, predecessors will
+		DisjointSet sets(BBList.size() + 1);
 
-		//MAY NEED TO ERROR CHECK FOR COMPLICATION DUE TO DUMMY BACK EDGE (EXIT --> ENTRY)
+		inMST.assign(edges.size(), false);
+		MST.push_back(edges[root]);
+		inMST[root] = true;
+		sets.merge(vertex(edges[root].base), vertex(edges[root].end));
 
-		//compute new predecessors
-		//for each predeccessors, compute a set of their predecessors and call this function with the new data. the first recursive call to return true is the path
-		for(unsigned int i = 0; i < predeccesors.size(); i++){
-			
-			//cross reference BBList
-		    int a, b;
-			bool skip = false;
-			for(unsigned int j = 0; j < BBList.size(); j++){
-				if(BBList[j] == predeccesors[i]){
-					a = j;
-					for(unsigned int l = 0; l < BBList.size(); l++){
-						if(BBList[l] == succ_source){
-							b = l;
-							break;
-						}
-					}
-					
-					if(a < b){
-						skip = true;
-						break;
-					}
-				}
-			}
-			
-			if(skip)
-				continue;
-		
-			vector<BasicBlock*> new_pred;
-			for(unsigned int x = 0; x < edges.size(); x++){
-				if(edges[x].end == predeccesors[i]){
-					new_pred.push_back(edges[x].base);
-				}	
+		//S, ordered by decreasing weight (ties keep edge order)
+		vector<unsigned> S;
+		for(unsigned int i = 0; i < edges.size(); i++){
+			if(i != root){
+				S.push_back(i);
 			}
-			
-			//if there is a path
-			if(getPath(path, succ_source, successors, predeccesors[i], new_pred)){
-				
-				//need to connect pred source to the predeccesor
-			
-				for(unsigned int x = 0; x < edges.size(); x++){
-					if(edges[x].base == predeccesors[i] && edges[x].end == pred_source){
-						path.push_back(edges[x]);
-					}
-				}
-								
-				/*errs() << "output path (mid algo):\n";
-				for(unsigned int x = 0; x < path.size(); x++){
-					printEdge(path[x]);
-					errs() << "\n";
-				}
-				errs() << "\n";*/
-
-				isPath = true;
-				return isPath;
+		}
+		stable_sort(S.begin(), S.end(), [&weight](unsigned a, unsigned b){ return weight[a] > weight[b]; });
+
+		//the blocks and EXIT need BBList.size() tree edges
+		for(unsigned int i = 0; i < S.size() && MST.size() < BBList.size(); i++){
+			//an edge whose endpoints are already connected would close a cycle, so it is a chord
+			if(sets.merge(vertex(edges[S[i]].base), vertex(edges[S[i]].end))){
+				MST.push_back(edges[S[i]]);
+				inMST[S[i]] = true;
 			}
-	
 		}
 
-		//return True if there exists a path (putting the path into "path" vector) or false is no path exists
-	
-		return isPath;
+		return MST;
 	}
 
-	//CS201 Helper Function to compute part 2 of ball larus algo.
-	vector<int> getChordIncs(vector<Edge> &chords, vector<Edge>& edges, vector<Edge>& MST){
-		BasicBlock* entry = BBList[0];
-		BasicBlock* exit = BBList[BBList.size() - 1];
-
-		vector<BasicBlock*> exitPreds; //vector of the exit node's predecessors
-		//have to iterate over the edges to get the exit block predecessors
-		for(unsigned int i = 0; i < edges.size(); i++){
-			if(edges[i].base == exit && edges[i].end == entry){
-				continue;
-			}
-			
-			if(edges[i].end == exit){
-				exitPreds.push_back(edges[i].base);
-			}
-		}
+	//CS201 Helper Function to give every block a potential: 0 at ENTRY, and along every tree edge a -> b, pot(b) = pot(a) + Val(a -> b).
+	//One walk over the tree edges (CSR lists). The sum of the values along any tree path is then the difference of its ends' potentials
+	void computeTreePotentials(vector<Edge> &edges, vector<bool> &inMST){
+		unsigned int n = BBList.size() + 1; //EXIT included
+		treePotential.assign(n, 0);
+
+		vector<bool> visited(n, false);
+		vector<unsigned> WS;
+		visited[0] = true;
+		WS.push_back(0);
+		while(!WS.empty()){
+			unsigned v = WS.back();
+			WS.pop_back();
+
+			//tree edges may point either way
+			for(int dir = 1; dir >= -1; dir -= 2){
+				vector<unsigned> &adj = (dir == 1) ? succEdges : predEdges;
+				vector<unsigned> &start = (dir == 1) ? succStart : predStart;
+				for(unsigned int i = start[v]; i < start[v+1]; i++){
+					unsigned e = adj[i];
+					unsigned w = vertex((dir == 1) ? edges[e].end : edges[e].base);
+					if(!inMST[e] || visited[w])
+						continue;
 
-		vector<BasicBlock*> entrySuccs; //same as above but for entry node
-		for(unsigned int i = 0; i < edges.size(); i++){
-			if(edges[i].base == exit && edges[i].end == entry){
-				continue;
-			}
-				
-			if(edges[i].base == entry){
-				
-				if(entrySuccs.empty()){
-					entrySuccs.push_back(edges[i].end);	
-				}else{
-					bool present = false;
-					for(unsigned int r = 0; r < entrySuccs.size(); r++){
-						if(entrySuccs[r] == edges[i].end){
-							present = true;	
-						}
-					}
-					
-					if(!present){
-						entrySuccs.push_back(edges[i].end);
-					}
+					visited[w] = true;
+					//wraps around like the path register does
+					treePotential[w] = treePotential[v] + (uint64_t)(dir * edges[e].value);
+					WS.push_back(w);
 				}
 			}
 		}
-			
-		/*errs() << "printing exit block's predecessors:\n";	
-		for(unsigned int i = 0; i < exitPreds.size(); i++){
-			exitPreds[i]->printAsOperand(errs(), false);
-			errs() << "\n";
-		}
-		errs() << "\n";
-	
-		errs() << "printing entry block's successors:\n";	
-		for(unsigned int i = 0; i < entrySuccs.size(); i++){
-			entrySuccs[i]->printAsOperand(errs(), false);
-			errs() << "\n";
-		}
-		errs() << "\n";*/
-
-
-		vector<int> chordIncs; //index matches index of "chords" (ie. Inc(chords[i]) = chordIncs[i]) --> what will be returned
-		vector<Edge> spanCycle;
-		bool usingChord = false; //presume we are not using chord at begin of algo
+	}
 
+	//CS201 Helper Function to compute part 2 of ball larus algo.
+	//Inc(chord) is the sum of the edge values around the chord's cycle in the spanning tree (edges walked against the chord's direction
+	//count negative). The cycle is the chord and the tree path back from its end to its base, so Inc(e) = Val(e) + pot(base) - pot(end)
+	vector<int64_t> getChordIncs(vector<unsigned> &chords, vector<Edge> &edges){
+		vector<int64_t> chordIncs(chords.size()); //index matches index of "chords" (ie. Inc(chords[i]) = chordIncs[i]) --> what will be returned
 		for(unsigned int i = 0; i < chords.size(); i++){
-			
-			//if the current chord is EXIT --> ENTRY, break out of loop (we done)
-			if(chords[i].base == exit && chords[i].end == entry){
-				break;
-			}
-
-			//errs() << "current chord: \n";
-			//printEdge(chords[i]);
-			//errs() << "\n\n";			
-
-			for(unsigned int x = 0; x < edges.size(); x++){
-				if(spanCycle.empty()){
-					//first case: first edge in "edges" is the chord, so need to seach for the path to the chord
-					if(edges[x].base == chords[i].base && edges[x].end == chords[i].end && edges[x].value == chords[i].value){
-						//set flag that using chord, so revert to default path finding (to 'exit' node)
-						usingChord = true;
-
-						//add edge to spanning Cycle
-						spanCycle.push_back(edges[x]);
-
-						//compute rest of cycle
-						vector<Edge> path;
-						
-						//get successor options after adding the edge to spanCycle
-						vector<BasicBlock*> end_succ;
-						BasicBlock* handle = spanCycle.back().end;//endpoint basicblock at the back of the current spanCycle	
-						for(unsigned int u = 0; u < edges.size(); u++){
-							if(edges[u].base == handle){
-								end_succ.push_back(edges[u].end);	
-							}	
-						}
-
-						/*errs() << "checking successors of last added edge's endpoint (when we already have the chord we need):\n";
-						for(unsigned int u = 0; u < end_succ.size(); u++){
-							end_succ[u]->printAsOperand(errs(), false);
-							errs() << "\n";
-						}
-						errs() << "\n";*/
-
-						getPath(path, handle, end_succ, exit, exitPreds);
-						spanCycle.insert(spanCycle.end(), path.begin(), path.end()); //append path to spanCycle
-
-						//add the backedge from "EXIT --> ENTRY" to finish spanCycle
-						for(unsigned int u = 0; u < edges.size(); u++){
-							if(edges[u].base == exit && edges[u].end == entry){ //at the dummy backedge
-								spanCycle.push_back(edges[u]);
-								
-								//output path (to check)
-								/*errs() << "Checking computed spanning cycle:\n";
-								for(unsigned int a = 0; a < spanCycle.size(); a++){
-									printEdge(spanCycle[a]);
-									errs() << "\n";
-								}
-								errs() << "\n";*/
-
-								break;
-							}
-						}
-
-						//spanCycle complete
-						break;
-					}
-					
-					//if spanCycle is empty, but the first edge is not the chord.
-					//need to find path from "entry" to chord[i].base, then a path from chord[i].end to "exit"
-					vector<Edge> path1; //ENTRY to chord[i].base
-					vector<Edge> path2; //chord[i].end to EXIT
-
-					vector<BasicBlock*> chordBasePred; //chord[i].base's preds
-					for(unsigned int f = 0; f < edges.size(); f++){
-						if(edges[f].end == chords[i].base){
-							chordBasePred.push_back(edges[f].base);
-						}
-					}
-
-					vector<BasicBlock*> chordEndSucc; //chord[i].end's succs
-					for(unsigned int f = 0; f < edges.size(); f++){
-						if(edges[f].base == chords[i].end){
-							chordEndSucc.push_back(edges[f].end);
-						}
-					}
-
-					//'exitPreds' holds Exit block's predecessors
-					//'entrySuccs' holds Entry block's successors
-					
-					//a path exist, add it to the spanCycle
-					//ENTRY to chord[i].base
-					if(getPath(path1, entry, entrySuccs, chords[i].base, chordBasePred)){
-						spanCycle.insert(spanCycle.end(), path1.begin(), path1.end());
-					}
-	
-					spanCycle.push_back(chords[i]);
-
-					//chord[i].end to EXIT
-					if(getPath(path2, chords[i].end, chordEndSucc, exit, exitPreds)){	
-						spanCycle.insert(spanCycle.end(), path2.begin(), path2.end());
-					}
-
-					//add the backedge from "EXIT --> ENTRY" to finish spanCycle
-					for(unsigned int u = 0; u < edges.size(); u++){
-						if(edges[u].base == exit && edges[u].end == entry){ //at the dummy backedge
-							spanCycle.push_back(edges[u]);
-							
-							//output path (to check)
-							/*errs() << "Checking computed spanning cycle:\n";
-							for(unsigned int a = 0; a < spanCycle.size(); a++){
-								printEdge(spanCycle[a]);
-								errs() << "\n";
-							}
-							errs() << "\n";*/
-
-							break;
-						}
-					}
-					
-				}//else if(!spanCycle.empty() && !usingChord){
-					//...
-				//}
-				break;
-			} 
-		
-			//compute chordIncs using spanCycle (add up values of each edge in spanCycle), store in "chordIncs" vector
-			
-			/*errs() << "Checking computed spanning cycle:\n";
-			for(unsigned int a = 0; a < spanCycle.size(); a++){
-				printEdge(spanCycle[a]);
-				errs() << "\n";
-			}
-			errs() << "\n";*/
-			
-			//increment over spanCycle, add the value of each edge to "inc", the push back inc to chordIncs
-			int inc = 0;
-			for(unsigned int d = 0; d < spanCycle.size(); d++){
-				inc += spanCycle[d].value;
-			}
-			chordIncs.push_back(inc);
-
-			//each chord will have it's own spanCycle to compute, so clear it when done with chords[i]
-			spanCycle.clear();
+			Edge &chord = edges[chords[i]];
+			chordIncs[i] = (int64_t)((uint64_t)chord.value + treePotential[vertex(chord.base)] - treePotential[vertex(chord.end)]);
 		}
-		//errs() << "---------------------------------\n\n";
-
-	
 		return chordIncs;
 	}
 
-	//CS201 Helper Function to assign values to edges (DAG)
-	void AssignVal(vector<Edge> &edges){
+	//CS201 Helper Function to assign values to edges (DAG), returns NumPaths(ENTRY), or -1 if it does not fit in 63 bits
+	int64_t AssignVal(vector<Edge> &edges, unsigned int needIndex){
 		//edge value assignment algorithm (Part 1 of 4 - Ball-Larus Algo.):
 		//
 		//for each vertex v in reverse topological order{
@@ -583,406 +386,312 @@ namespace {
 		//	}
 		//}
 
-		vector<BasicBlock*> topOrder; //topological ordering of 'vertices'
-		vector<int> numPaths; //index is aligned with 'topOrder'	
+		vector<int64_t> &numPaths = pathsFrom; //index is aligned with 'BBList', then EXIT
+		numPaths.assign(BBList.size() + 1, 0);
 
-		//errs() << "new size of edges: " << edges.size() << "\n";	
-		for(int i = BBList.size() - 1; i >= 0; i--){
-			//errs() << i << "\n";
-			topOrder.push_back(BBList[i]);	
-		}				
-	
-		numPaths.resize(topOrder.size(), 0);
-		/*errs() << "checking topological ordering:\n";
-		for(unsigned int i = 0; i < topOrder.size(); i++){
-			topOrder[i]->printAsOperand(errs(), false);
-			errs() << "\n";
-		}*/
-
-		int w; //index for 'w' in 'v->w'
-		for(unsigned int i = 0; i < topOrder.size(); i++){
-			//edges[i].end is a leaf
-			if(topOrder[i]->getTerminator()->getNumSuccessors() == 0){
-				numPaths[i] = 1;
-			}else{
-				numPaths[i] = 0;
-
-				for(unsigned int j = 0; j < edges.size(); j++){
-					if(edges[j].base == topOrder[i]){
-
-						//find index of 'end' basic block						
-						for(unsigned int y = 0; y < topOrder.size(); y++){
-							if(edges[j].end == topOrder[y]){
-								w = y;
-							}
-						}
-
-						//compute value for edge
-						edges[j].value = numPaths[i];
-						numPaths[i] = numPaths[i] + numPaths[w];
-					}
-				}
+		for(int t = topoOrder.size() - 1; t >= 0; t--){
+			unsigned v = topoOrder[t];
+			numPaths[v] = 0;
+			for(unsigned int i = succStart[v]; i < succStart[v+1]; i++){
+				if(succEdges[i] == needIndex)
+					continue;
+				Edge &e = edges[succEdges[i]];
+
+				//compute value for edge
+				e.value = numPaths[v];
+				if(numPaths[vertex(e.end)] > INT64_MAX - numPaths[v])
+					return -1;
+				numPaths[v] = numPaths[v] + numPaths[vertex(e.end)];
 			}
+
+			//a leaf (only EXIT, the blocks without successors flow into it through their dummy edges)
+			if(numPaths[v] == 0)
+				numPaths[v] = 1;
 		}
-		//errs() << i << "\n";
-		
 		
+		return numPaths[0];
 	}
 
+	//CS201 Helper Function to order the blocks of the DAG topologically (Kahn, over the CSR lists), EXIT -> ENTRY is left out
+	//returns false if the edges still have a cycle
+	bool computeTopoOrder(vector<Edge> &edges, unsigned int needIndex){
+		unsigned int n = BBList.size() + 1; //EXIT included
+		vector<unsigned> inDegree(n, 0);
+		for(unsigned int v = 0; v < n; v++){
+			for(unsigned int k = predStart[v]; k < predStart[v+1]; k++){
+				if(predEdges[k] != needIndex)
+					inDegree[v]++;
+			}
+		}
 
-	//CS201 Helper Function to help compute loop (Insert function from algo. in lecture slides)
-	void Insert(stack<BasicBlock*> &Stack, vector<BasicBlock*> &loop, BasicBlock* m){
-		//Insert Algo. :
-		//
-		// if m not in Loop then
-		// 		Loop = Loop U {m}
-		//		push m onto Stack
-		// endif
-		// EndInsert
-		
-		bool isIn = false;
-		for(unsigned int i = 0; i < loop.size(); i++){
-			if(m == loop[i]){
-				isIn = true;
+		topoOrder.clear();
+		for(unsigned int v = 0; v < n; v++){
+			if(inDegree[v] == 0)
+				topoOrder.push_back(v);
+		}
+		//topoOrder doubles as the queue
+		for(unsigned int t = 0; t < topoOrder.size(); t++){
+			unsigned v = topoOrder[t];
+			for(unsigned int k = succStart[v]; k < succStart[v+1]; k++){
+				if(succEdges[k] == needIndex)
+					continue;
+				unsigned w = vertex(edges[succEdges[k]].end);
+				if(--inDegree[w] == 0)
+					topoOrder.push_back(w);
 			}
 		}
-		
-		if(!isIn){
-			loop.push_back(m);
-			Stack.push(m);
-		}		
+		return topoOrder.size() == n;
+	}
+
+
+	//CS201 Helper Function - the blocks of a loop in BBList order
+	vector<BasicBlock*> getLoopBlocks(Loop *L){
+		vector<unsigned> BlockPlace; //inorder index of BasicBlocks in loop
+		for(auto it = L->block_begin(); it != L->block_end(); ++it){
+			BlockPlace.push_back(BBIndex[*it]);
+		}
+		sort(BlockPlace.begin(), BlockPlace.end());
 
+		vector<BasicBlock*> o_loop; //ordered loop
+		for(unsigned int i = 0; i < BlockPlace.size(); i++){
+			o_loop.push_back(BBList[BlockPlace[i]]);
+		}
+		return o_loop;
 	}
 
-	//CS201 Helper function to compute loops
-	vector<BasicBlock*> computeLoop(Edge &backEdge){
-		//Loop Algo. :
-		//
-		// Given a back edge, N -> D	
-		//
-		// Stack = empty
-		// Loop = {D}
-		// Insert(N)
-		//
-		// While stack not empty do
-		//		pop m --> (top element of stack)
-		// 		for each p in pred(m) do 
-		//			Insert(p)
-		//		endfor
-		// endWhile
-
-		vector<BasicBlock*> loop;
-
-		stack<BasicBlock*> Stack; //empty stack
-		BasicBlock* N = backEdge.base;
-		BasicBlock* D = backEdge.end;
-		
-		loop.push_back(D);
-		Insert(Stack, loop, N);
-		while(!Stack.empty()){
-			BasicBlock* m = Stack.top();
-			Stack.pop();
-
-			for(auto it = pred_begin(m), et = pred_end(m); it != et; ++it){
-				BasicBlock* Pred = *it;
-				Insert(Stack, loop, Pred);
+	//CS201 Helper Function - adds L and the loops nested in it to 'loops'
+	void addLoops(Loop *L){
+		loops.push_back(L);
+		for(auto it = L->begin(); it != L->end(); ++it){
+			addLoops(*it);
+		}
+	}
+
+	//CS201 Helper Function - makes the innermost loops regions of their own: every edge between blocks of different regions is cut
+	//(isCut), so a region is only entered through its header. A loop with a back edge to another block (an irreducible cycle inside it) is left out
+	void addLoopRegions(vector<bool> &isCut){
+		blockRegion.assign(BBList.size(), -1);
+		for(unsigned int i = 0; i < loops.size(); i++){
+			if(!loops[i]->getSubLoops().empty())
+				continue;
+			for(auto it = loops[i]->block_begin(); it != loops[i]->block_end(); ++it){
+				blockRegion[BBIndex[*it]] = regions.size();
 			}
+			regions.push_back(loops[i]);
 		}
 
-		//reorder final loop result in descending-CFG order
-		vector<BasicBlock*> o_loop; //ordered loop (initially empty)
-		//o_loop.reserve(loop.size());
-		bool done = false; //set to 'true' when we have ordered everything
-		vector<int> BlockPlace; //inorder index of BasicBlocks in loop
-		while(!done){
-			
-			for(unsigned int i = 0; i < loop.size(); i++){
-				for(unsigned int j = 0; j < BBList.size(); j++){
-					if(loop[i] == BBList[j]){
-						//errs() << j << "\n";
-						BlockPlace.push_back(j); //vector of indices into 'loop' vector
-						break;
-					}
+		for(unsigned int i = 0; i < edges.size(); i++){
+			int r = blockRegion[BBIndex[edges[i].end]];
+			if(isCut[i] && r != -1 && edges[i].end != regions[r]->getHeader()){
+				for(auto it = regions[r]->block_begin(); it != regions[r]->block_end(); ++it){
+					blockRegion[BBIndex[*it]] = -1;
 				}
+				regions[r] = NULL;
 			}
+		}
 
-			//sorting
-			sort(BlockPlace.begin(), BlockPlace.end());
-			
-			//errs() << "size: " << BlockPlace.size() << "\n";
-			for(unsigned int i = 0; i < BlockPlace.size(); i++){
-				//errs() << BlockPlace[i] << "\n";
-				o_loop.push_back(BBList[BlockPlace[i]]);
+		//renumber the regions that are left
+		vector<int> renumber(regions.size(), -1);
+		unsigned int kept = 0;
+		for(unsigned int r = 0; r < regions.size(); r++){
+			if(regions[r]){
+				renumber[r] = kept;
+				regions[kept++] = regions[r];
 			}
-	
-			done = true;
+		}
+		regions.resize(kept);
+		for(unsigned int v = 0; v < BBList.size(); v++){
+			if(blockRegion[v] != -1)
+				blockRegion[v] = renumber[blockRegion[v]];
 		}
 
-		return o_loop;
+		for(unsigned int i = 0; i < edges.size(); i++){
+			if(blockRegion[BBIndex[edges[i].base]] != blockRegion[BBIndex[edges[i].end]])
+				isCut[i] = true;
+		}
 	}
 
-	//CS201 Helper function - print dominator sets of function
-	void printFuncDomSets(vector<vector<BasicBlock*>> &funcDomSet){
-		//index of funcDomSet number is the owner of element dominator set
-		
-		//NEED to ENUMERATE Basic Block names --- HERE
-		errs() << "------------Printing Dominator Sets--------------:\n" << '\n';
-		for(unsigned int i = 0; i < funcDomSet.size(); i++){
+	//CS201 Helper Function - first path of loop region r, its paths are [regionFirstPath(r), regionFirstPath(r) + regionPaths(r))
+	int64_t regionFirstPath(int r){
+		return edges[regionEntry[r]].value;
+	}
 
-			errs() << "BasicBlock: ";
-			BBList[i]->printAsOperand(errs(), false);
-			errs() << " Dominator Set\n";
-			errs() << "{";
+	int64_t regionPaths(int r){
+		return pathsFrom[BBIndex[regions[r]->getHeader()]];
+	}
 
-			for(unsigned int j = 0; j < funcDomSet[i].size(); j++){
-				
-				funcDomSet[i][j]->printAsOperand(errs(), false);
-				if((j+1) == funcDomSet[i].size()){
+	//CS201 Helper Function - marks the back edges of the CFG in 'edges' (CSR lists built): the edges a depth first search from
+	//ENTRY finds going to a block still on its stack. These are the latch -> header edges of the loops, plus whatever is needed to
+	//break irreducible cycles, so the rest of the edges form a DAG. Blocks ENTRY does not reach start searches of their own
+	vector<bool> findBackEdges(){
+		unsigned int n = BBList.size();
+		vector<bool> isBack(edges.size(), false);
+		vector<char> state(n, 0); //0 not seen, 1 on the stack, 2 done
+		vector<pair<unsigned, unsigned> > stack; //block, next successor edge to look at
+
+		for(unsigned int root = 0; root < n; root++){
+			if(state[root] != 0)
+				continue;
+			state[root] = 1;
+			stack.push_back(make_pair(root, succStart[root]));
+			while(!stack.empty()){
+				unsigned v = stack.back().first;
+				unsigned k = stack.back().second;
+				if(k == succStart[v+1]){
+					state[v] = 2;
+					stack.pop_back();
 					continue;
 				}
-				errs() << ", ";
+				stack.back().second++;
+
+				unsigned e = succEdges[k];
+				unsigned w = BBIndex[edges[e].end];
+				if(state[w] == 1){
+					isBack[e] = true;
+				}else if(state[w] == 0){
+					state[w] = 1;
+					stack.push_back(make_pair(w, succStart[w]));
+				}
 			}
-
-			errs() << "}\n";
-			errs() << "\n";				
 		}
-		errs() << "----------------------END-------------------------:\n" << '\n';				
+		return isBack;
 	}
 
-	//CS201 Helper Function - computer dominator set for given node (basic block) in function
-	vector<BasicBlock*> computeDomSet(Function &f, DomTreeNode *node, DominatorTree *domTree){
-		vector<BasicBlock*> basicblkDomSet;
+	//CS201 Helper function - print dominator sets of function
+	//sets are walked up the dominator tree one block at a time, so only the output itself is ever O(V^2)
+	void printFuncDomSets(DominatorTree *domTree){
+		log << "------------Printing Dominator Sets--------------:\n" << '\n';
+		vector<unsigned> basicblkDomSet;
+		for(unsigned int i = 0; i < BBList.size(); i++){
+
+			log << "BasicBlock: ";
+			BBList[i]->printAsOperand(log, false);
+			log << " Dominator Set\n";
+			log << "{";
+
+			//dominators of a block are its ancestors in the dominator tree (unreachable blocks have no node)
+			for(DomTreeNode *node = domTree->getNode(BBList[i]); node != NULL; node = node->getIDom()){
+				basicblkDomSet.push_back(BBIndex[node->getBlock()]);
+			}
+			sort(basicblkDomSet.begin(), basicblkDomSet.end());
 
-		DomTreeNode *start = node;
-		for(auto &BB: f){
-			DomTreeNode *bb = domTree->getNode(&BB);
-			//Check if current bb dominates given "node"
-			if(domTree->dominates(bb, start)){
-				basicblkDomSet.push_back(&BB);
+			for(unsigned int j = 0; j < basicblkDomSet.size(); j++){
+				
+				BBList[basicblkDomSet[j]]->printAsOperand(log, false);
+				if((j+1) == basicblkDomSet.size()){
+					continue;
+				}
+				log << ", ";
 			}
-		}
-		
+			basicblkDomSet.clear();
 
-		//return dominator set for given node
-		return basicblkDomSet;
+			log << "}\n";
+			log << "\n";				
+		}
+		log << "----------------------END-------------------------:\n" << '\n';				
 	}
 
-    //---------------------------------- CS210 --- This function is run for each 'function' in the input test file
+    //---------------------------------- CS201 --- Everything about F up to the instrumentation (blocks are already named by the pass)
 	// 
-    bool runOnFunction(Function &F) override {
-	  vector<vector<BasicBlock*>> funcDomSet; // each element is dominator set of the function's BBs
-	 // vector<Edge> edges; //vector of edges (per function)
-	 // vector<vector<BasicBlock*>> loops; //will hold all the loops found in the function
-	  old_edges = edges;		
-
-	  errs() << "Function: " << F.getName() << "\n";
-
-	  //construct dominator tree for function F
-	  DominatorTree *domTree = new DominatorTree();
-	  domTree->recalculate(F);
-	  //domTree->print(errs());
+    void analyze() {
+	  Function &F = *this->F;
 
 	  //get basic block list
 	  for(auto &BB: F){
-		BB.setName("b");
+		BBIndex[&BB] = BBList.size();
 		BBList.push_back(&BB);
 	  }
+	  cfgHash = computeCfgHash();
 
-	  //attempts to fine tune basic block name for 'b0'
-	  for(auto &BB: F){
-		if(BB.getName() == "b"){
-			BB.setName("b0");
-			for(unsigned int i = 0; i < BBList.size(); i++){
-				if(BBList[i]->getName() == "b"){
-					BBList[i]->setName("b0");
-					break;
-				}
-			}
-			break;
-		}	
+	  //profile use only needs the block numbering and the CFG hash to find F's counts, and prints nothing
+	  if(!ProfileUseFile.empty()){
+		findPriorProfile();
+		return;
 	  }
+	  log << "Function: " << name << "\n";
+
+	  //construct dominator tree for function F
+	  DominatorTree domTree;
+	  domTree.recalculate(F);
+	  //domTree.print(log);
 	  
 	  for(auto &BB: F){	
 		runOnBasicBlock(BB);
 			
 	  }
 
+	  //check that dominator sets are correct
+	  if(PrintDomSets){
+		printFuncDomSets(&domTree);
+	  }
+
 	  // CS201 --- loop iterates over each basic block in each function in the input file, calling the runOnBasicBlock function on each encountered basic block
 	  for(auto &BB: F){		
-	  	DomTreeNode *bb = domTree->getNode(&BB);
-		funcDomSet.push_back(computeDomSet(F, bb, domTree));
-		
-	  	/*IRBuilder<> IRB(BB.getFirstInsertionPt()); //gets placed before the first instruction in the basic block
-	  	Value *loadAddr = IRB.CreateLoad(bbCounter);
-	  	Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), 1), loadAddr);
-	  	IRB.CreateStore(addAddr, bbCounter);*/
-
-		//FIRST PASS to find EDGES (now done at Initialization
+		//FIRST PASS to find EDGES of this function (for path profiling, addEdgeProfile builds its own CFG)
 		//finding back edges -----------------------------------------------------------------------------------------
-		/*for(auto &I: BB){
-			if(isa<BranchInst>(I)){
-				//I is the branch instruction, need to iterate over the instructions successor to find back edge
-				for(unsigned int i = 0; i < cast<BranchInst>(I).getNumSuccessors(); i++){
-					Edge edge{&BB, cast<BranchInst>(I).getSuccessor(i), 0};
-					edges.push_back(edge);
-				}	
-			}
-			
-		}*/
-		//finding back edges end ---------------------------------------------------------------------------------------
-
-		//SECOND PASS to increment edge counter (EDGE PROFILING DONE HERE)
-		for(auto &I: BB){
-			if(isa<BranchInst>(I)){
-
-				/*if(cast<BranchInst>(I).getNumSuccessors() == 1){
-						IRBuilder<> IRB(&I);
-						Value *loadAddr = IRB.CreateLoad(edgeCounters[j]);
-						Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), 1), loadAddr);
-						IRB.CreateStore(addAddr, edgeCounters[j]);
-				}*/
-
-				for(unsigned int i = 0; i < cast<BranchInst>(I).getNumSuccessors(); i++){
-
-					for(unsigned int j = 0; j < edges.size(); j++){
-						
-						if((edges[j].base == &BB) && (edges[j].end == cast<BranchInst>(I).getSuccessor(i))){
-						
-							if(cast<BranchInst>(I).getNumSuccessors() == 1){
-								IRBuilder<> IRB(&I);
-								Value *loadAddr = IRB.CreateLoad(edgeCounters[j]);
-								Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), 1), loadAddr);
-								IRB.CreateStore(addAddr, edgeCounters[j]);
-							}else{
-								IRBuilder<> IRB(cast<BranchInst>(I).getSuccessor(i)->getFirstInsertionPt());
-								Value *loadAddr = IRB.CreateLoad(edgeCounters[j]);
-								Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), 1), loadAddr);
-								IRB.CreateStore(addAddr, edgeCounters[j]);
-							}
-
-						}
-					}
-
-				}
-			}
-		}
-		//
-
-		//FINAL OUTPUT (CHANGE BBCOUNTER)
-		if(F.getName().equals("main") && isa<ReturnInst>(BB.getTerminator())){
-		   for(unsigned int i = 0; i < edgeCounters.size() + 1; i++){
-				string result = "";				
-
-				if(i == edgeCounters.size()){
-					result = "PATH PROFILING:\n";
-				}else{
-				
-					//string result = "";
-					if(i == 0){
-						result = "EDGE PROFILING:\n";
-					}	
-				
-					//const char *base = (edges[i].base->getName().str()).c_str();
-					if(old_edges[i].base->getName().str() == "b"){
-						result = result + old_edges[i].base->getName().str() + "0 -> " + old_edges[i].end->getName().str() + ": %d\n"; 
-					}else if(old_edges[i].end->getName().str() == "b"){
-						result = result + old_edges[i].base->getName().str() + " -> " + old_edges[i].end->getName().str() + "0: %d\n"; 
-					}else{
-						result = result + old_edges[i].base->getName().str() + " -> " + old_edges[i].end->getName().str() + ": %d\n"; 
-					}
-					
-					if(i == edgeCounters.size() - 1){
-						result = result + "\n";
-					}
-				}
-		
-	  			const char *finalPrintString = result.c_str();//" -> : %d\n"; 
-	  			Constant *format_const = ConstantDataArray::getString(*Context, finalPrintString);
-	  			BasicBlockPrintfFormatStr = new GlobalVariable(*(F.getParent()), llvm::ArrayType::get(llvm::IntegerType::get(*Context, 8), strlen(finalPrintString)+1), true, llvm::GlobalValue::PrivateLinkage, format_const, "BasicBlockPrintfFormatStr");
-	  			//printf_func = printf_prototype(*Context, &M);
-
-				//addFinalPrintf(BB, Context, edgeCounters[i], BasicBlockPrintfFormatStr, printf_func);
-				if(i < edgeCounters.size()){
-					addFinalPrintf(BB, Context, edgeCounters[i], BasicBlockPrintfFormatStr, printf_func);
-				}else{
-					addFinalPrintf(BB, Context, edgeCounters[i-1], BasicBlockPrintfFormatStr, printf_func);
-				}
-		   }
+		//every terminator (br, switch, invoke, indirectbr) lists its edges as successors
+		TerminatorInst *TI = BB.getTerminator();
+		for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+			Edge edge{&BB, TI->getSuccessor(i), 0, i};
+			edges.push_back(edge);
 		}
+		//finding back edges end ---------------------------------------------------------------------------------------
 
 		//runOnBasicBlock(BB);
 	  }	
 	  
-	  //store backedges here
-	  vector<Edge> backEdges;
-	
-	  //BBList contains in order basic block
-	  //finding/storing backedges ----------------------
-	  //errs() << "Printing edge list:\n";
-	  int indBase = 0;
-	  int indEnd = 0;
-	  for(unsigned int i = 0; i < edges.size(); i++){
-		  //printEdge(edges[i]);
-		  //errs() << "\n";
-
-		  //get heirarchy of edge base node
-		  for(unsigned int y = 0; y < BBList.size(); y++){
-		  	if(BBList[y] == edges[i].base){
-				indBase = y;	
-			}
-		  }
-
-		  //get heirarchy of edge end node
-		  for(unsigned int y = 0; y < BBList.size(); y++){
-		  	if(BBList[y] == edges[i].end){
-				indEnd = y;	
-			}
-		  }
+	  buildAdjacency(edges);
+	  vector<bool> isCut = findBackEdges();
 
-		  //if |base node| > |end node|, then edge[i] is a back edge
-		  if(indBase > indEnd){
-			backEdges.push_back(edges[i]);
-				
-		  }
-	
+	  //loop forest from the dominator tree
+	  loopInfo.Analyze(domTree);
+	  for(auto it = loopInfo.begin(); it != loopInfo.end(); ++it){
+		addLoops(*it);
 	  }
-	  //errs() << "\n";
-
-	  //errs() << "\nback edges (count: " << backEdges.size() << "):\n";
-	  for(unsigned int i = 0; i < backEdges.size(); i++){
-		//printEdge(backEdges[i]);	
-		//errs() << "\n";
+	  sort(loops.begin(), loops.end(), [this](Loop *a, Loop *b){ return BBIndex[a->getHeader()] < BBIndex[b->getHeader()]; });
 
-		//verify that 'end' dominates 'base'
-		if(domTree->dominates(backEdges[i].end, backEdges[i].base)){
-			//pass each backedge into helper function to compute the loop (basicblock) list
-			loops.push_back(computeLoop(backEdges[i]));
+	  //Output Loops, a loop with loops nested in it is not innermost
+	  for(unsigned int i = 0; i < loops.size(); i++){
+		vector<BasicBlock*> loop = getLoopBlocks(loops[i]);
+		if(loops[i]->getSubLoops().empty()){
+			log << "Innermost Loops: {";
+		}else{
+			log << "Outer Loops (depth " << loops[i]->getLoopDepth() << "): {";
 		}
-	  }
-	  //errs() << "\n";
-	  //-----------------------------------------
-
-	
-	  //Output Loops
-	  //errs() << "LOOP COUNT: " << loops.size() << "\n\n";
-
-	  for(unsigned int i = 0; i < loops.size(); i++){
-	  	errs() << "Innermost Loops: {";
-		for(unsigned int j = 0; j < loops[i].size(); j++){
-			loops[i][j]->printAsOperand(errs(), false);
+		for(unsigned int j = 0; j < loop.size(); j++){
+			loop[j]->printAsOperand(log, false);
 			
-			if((j+1) < loops[i].size()){
-				errs() << ",";
+			if((j+1) < loop.size()){
+				log << ",";
 			}
 		}
-		errs() << "}\n";
+		log << "}\n";
 
       }
 		
 	  if(loops.size() == 0){
-		errs() << "Innermost Loops: {}\n";
+		log << "Innermost Loops: {}\n";
+	  }
+
+	  //store the cut edges here, in edge order
+	  if(LoopRegions){
+		addLoopRegions(isCut);
+	  }else{
+		blockRegion.assign(BBList.size(), -1);
+	  }
+	  for(unsigned int i = 0; i < edges.size(); i++){
+		if(isCut[i]){
+			cutEdges.push_back(edges[i]);
+		}
 	  }
 
+	  //edge frequencies for the spanning trees
+	  computeBlockWeights();
+
+	  //EDGE PROFILING DONE HERE (the pass adds the counters)
+	  computeEdgeProfile();
+	  findAccumulatorLoops();
+
 
 		
 	  //edge value code
@@ -992,144 +701,127 @@ namespace {
 	  //BasicBlock *exit = BasicBlock::Create(*Context, "EXIT", &F, &(F.getEntryBlock()));
 
 	  //CURRENTLY NEED TO CONVERT CFG TO DAG (LOOK AT NOTES, TABS) TO COMPUTE THE EDGE VALUES
-	  BasicBlock *entry = &(F.front()); //value = 99
-	  BasicBlock *exit = &(F.back()); //value = 100 (to help distinguish between ENTRY and EXIT dummy edges
-	  for(unsigned int i = 0; i < backEdges.size(); i++){
-			//add dummy ENTRY edge
-			Edge Entry{entry, backEdges[i].end, 99};
-			edges.push_back(Entry);
+	  //EXIT is a vertex of its own, so a function that never returns (for(;;) workers) still has one
+	  entry = &(F.front());
+
+	  //remove cut edges from edge list (graph)
+	  unsigned int kept = 0;
+	  for(unsigned int i = 0; i < edges.size(); i++){
+		if(!isCut[i]){
+			edges[kept++] = edges[i];
+		}
+	  }
+	  edges.resize(kept);
+	  numDAGEdges = edges.size();
+
+	  vector<int> entryDummyOf(BBList.size(), -1);
+	  for(unsigned int i = 0; i < cutEdges.size(); i++){
+			//add dummy ENTRY edge, one per target block
+			unsigned int w = BBIndex[cutEdges[i].end];
+			if(entryDummyOf[w] == -1){
+				Edge Entry{entry, cutEdges[i].end, 99};
+				entryDummyOf[w] = edges.size();
+				edges.push_back(Entry);
+			}
+			entryDummy.push_back(entryDummyOf[w]);
 
 			//add dummy EXIT edge
-			Edge Exit{backEdges[i].base, exit, 100};
+			Edge Exit{cutEdges[i].base, NULL, 100};
+			exitDummy.push_back(edges.size());
 			edges.push_back(Exit);
-			
-			//need edge from exit to entry for part 2 of ball larus algo
-			Edge Need{exit, entry, 0};
-			edges.push_back(Need);
-
-			//remove back edge for edge list (graph)
-			for(unsigned int j = 0; j < edges.size(); j++){
-				if((((backEdges[i].base == edges[j].base) && (backEdges[i].end == edges[j].end))) && ((edges[j].value != 99) && (edges[j].value != 100))){
-					edges.erase(edges.begin()+(j));
-				}
-			}
 	  }
 
+	  for(unsigned int r = 0; r < regions.size(); r++){
+		regionEntry.push_back(entryDummyOf[BBIndex[regions[r]->getHeader()]]);
+	  }
+
+	  //every leaf (returns, unreachable) ends its paths at EXIT
+	  for(unsigned int i = 0; i < BBList.size(); i++){
+		if(BBList[i]->getTerminator()->getNumSuccessors() == 0){
+			Edge Leaf{BBList[i], NULL, 0};
+			leafDummy.push_back(edges.size());
+			edges.push_back(Leaf);
+		}
+	  }
+
+	  //need edge from exit to entry for part 2 of ball larus algo
+	  Edge Need{NULL, entry, 0};
+	  unsigned int needIndex = edges.size();
+	  edges.push_back(Need);
 	  
 	  //'edges' vector now represents the DAG representation of the function
-	  AssignVal(edges);
+	  buildAdjacency(edges);
+	  if(!computeTopoOrder(edges, needIndex)){
+		log << "Cycle left after removing the cut edges, skipping path profiling\n\n";
+		return;
+	  }
+	  numPaths = AssignVal(edges, needIndex);
+	  if(numPaths < 0){
+		log << "More than 2^63 paths, skipping path profiling\n\n";
+		return;
+	  }
 	   
-	  /*errs() << "Printing DAG edges:\n";
+	  /*log << "Printing DAG edges:\n";
 	  for(unsigned int i = 0; i < edges.size(); i++){
 		printEdge(edges[i]);
-		errs() << "\n";
+		log << "\n";
 	  }
-	  errs() << "\n";*/
+	  log << "\n";*/
 
 	  //print out edge values with Ball-Larus values
-	  //bool printedComma = false;
-	  bool done = false;
-	  vector<BasicBlock*> seen;
 	  for(unsigned int i = 0; i < loops.size(); i++){
-	  	errs() << "Edge Values: {";
-		for(unsigned int j = 0; j < loops[i].size(); j++){
+	  	log << "Edge Values: {";
+		vector<BasicBlock*> loop = getLoopBlocks(loops[i]);
+		for(unsigned int j = 0; j < loop.size(); j++){
 			
-			for(unsigned int v = 0; v < edges.size(); v++){
-				if(loops[i][j] == edges[v].base){
-					
-					for(unsigned int q = 0; q < loops[i].size(); q++){
+			unsigned int b = BBIndex[loop[j]];
+			for(unsigned int k = succStart[b]; k < succStart[b+1]; k++){
+				unsigned int v = succEdges[k];
 					
-						if(edges[v].end == loops[i][q]){					
-							printEdge(edges[v]);
-
-							if(seen.size() == 0){
-								seen.push_back(edges[v].base);
-								seen.push_back(edges[v].end);
-							}else{
-								bool here = false;
-								for(unsigned int e = 0; e < seen.size(); e++){
-									if(edges[v].base == seen[e]){
-										here = true;
-										break;
-									}
-								}
-								
-								if(!here)
-									seen.push_back(edges[v].base);
-
-								here = false;
-								for(unsigned int e = 0; e < seen.size(); e++){
-									if(edges[v].end == seen[e]){
-										here = true;
-										break;
-									}
-								}
-								
-								if(!here)
-									seen.push_back(edges[v].end);
-							}
-
-							//errs() << ",";
-							if(seen.size() == loops[i].size()){
-								done = true;
-							}
-
-							//if(!done){
-							//errs() << "seen size: " << seen.size() << "\n";
-							errs() << ",";
-								//printedComma = true;
-							//}
-						}
-	
-					}
+				if(edges[v].end && loops[i]->contains(edges[v].end)){					
+					printEdge(edges[v]);
+					log << ",";
 				}
 			}			
-
-			//errs() << "j: " << j << "\n";
-			//if((j+1) < loops[i].size() && !done){// && !printedComma){
-			//	errs() << ",";
-				//printedComma = false;
-			//}
 		}
-		errs() << "}\n\n";
+		log << "}\n\n";
 
       }
 		
 	  if(loops.size() == 0){
-		errs() << "Edge values: {}\n\n";
+		log << "Edge values: {}\n\n";
 	  }
 		
 	  //Ball Larus part 2
-	  //need to compute maximal cost ST of (DAG) edges
-	  vector<Edge> MST = computeMST(edges);
+	  //need to compute maximal cost ST of (DAG) edges, a dummy edge is as frequent as the cut edges or return it stands for
+	  vector<double> weight(edges.size(), 0);
+	  //edges that can not carry code are kept in the tree, where they usually need none
+	  for(unsigned int i = 0; i < numDAGEdges; i++){
+		weight[i] = canInstrumentEdge(edges[i].base, edges[i].end) ? edgeWeight(edges[i].base, edges[i].end) : HUGE_VAL;
+	  }
+	  for(unsigned int i = 0; i < cutEdges.size(); i++){
+		weight[exitDummy[i]] = edgeWeight(cutEdges[i].base, cutEdges[i].end);
+		weight[entryDummy[i]] += weight[exitDummy[i]];
+	  }
+	  for(unsigned int i = 0; i < leafDummy.size(); i++){
+		weight[leafDummy[i]] = edgeWeight(edges[leafDummy[i]].base, NULL);
+	  }
+	  vector<bool> inMST;
+	  vector<Edge> MST = computeMST(edges, weight, needIndex, inMST);
 
  	  //any edge from 'edges' not in MST are in the 'chord'
-	  vector<Edge> chords;
+	  vector<unsigned> chords; //edge indices of the chords
+	  vector<int> chordOf(edges.size(), -1); //index into 'chords' for each chord edge, -1 for tree edges
 	  for(unsigned int i = 0; i < edges.size(); i++){
-		bool notHere = true;
-	  	for(unsigned int j = 0; j < MST.size(); j++){
-			if((edges[i].base == MST[j].base) && (edges[i].end == MST[j].end) && (edges[i].value == MST[j].value)){
-				notHere = false;
-			}
-		}	
-		
-		if(notHere){
-			chords.push_back(edges[i]);	
+		if(!inMST[i]){
+			chordOf[i] = chords.size();
+			chords.push_back(i);	
 		}	
 	  }
 
 	  //vector of 'chord' increments
-	  vector<int> chordInc = getChordIncs(chords, edges, MST); //index matches with chord index
-
-	  //output chordIncs
-	  /*errs() << "Inc(chords): \n";
-	  for(unsigned int i = 0; i < chordInc.size(); i++){
-		errs() << "Inc(";
-		printEdge(chords[i]);
-		errs() << "): " << chordInc[i] << "\n";
-	  }
-	  errs() << "\n";*/
-
+	  computeTreePotentials(edges, inMST);
+	  vector<int64_t> chordInc = getChordIncs(chords, edges); //index matches with chord index
 
       //Part 3 Ball-Larus: Instrumentation
 	  
@@ -1146,71 +838,50 @@ namespace {
 	  //		else instrument(e, 'r=0');
 	  //}
 
+	  vector<unsigned> WS; //DAG vertices
 
-	  vector<BasicBlock*> WS;
-
-	  vector<Edge> instrumentedChords;
-	  vector<int> instrumentationR; //holds instrumentation data to be used when we add code to program, 'r=#'
-	  for(unsigned int i = 0; i < edges.size(); i++){
-		instrumentationR.push_back(0);
-	  }
+	  regInstr.assign(edges.size(), R_NONE);
+	  instrumentationR.assign(edges.size(), 0); //holds instrumentation data to be used when we add code to program, 'r=#'
+	  memInstr.assign(edges.size(), M_NONE);
+	  instrumentationM.assign(edges.size(), 0); // 'count[...]++'
 
-	  //vector<Edge> corresEdgeR;
-
-	  vector<int> instrumentationM; // 'count[...]++'
-	  for(unsigned int i = 0; i < edges.size(); i++){
-		instrumentationM.push_back(0);
-	  }
-	  //vector<Edge> corresEdgeM;
-
-	  WS.push_back(BBList[0]); //WS.add(ENTRY)
+	  WS.push_back(vertex(entry)); //WS.add(ENTRY)
 	  while(!WS.empty()){
-	  	BasicBlock* v = WS.back();
+	  	unsigned int v = WS.back();
 		WS.pop_back();
 	
-		//bool done = false;
-		bool isChord = false;
-		int chordIndex = 0;
-		for(unsigned int i = 0; i < edges.size(); i++){
-			if(edges[i].base == v){	
-				//if e is chord edge
-				for(unsigned int y = 0; y < chords.size(); y++){ //dont want to count dummy backedge
-					if(edges[i].base == chords[y].base && edges[i].end == chords[y].end && edges[i].value == chords[y].value){
-						//instrumentation[y] = chordInc[y];
-						instrumentedChords.push_back(chords[y]);
-						isChord = true;
-						chordIndex = y;
-					}
-				}
-				
-				if(isChord){
-					instrumentationR[i] = (chordInc[chordIndex]);
-					//corresEdgeR.push_back(edges[i]);
-					continue;
-				}
-				
-				//if e is the only incoming edge of w
-				int numW = 0;
-				for(unsigned int h = 0; h < edges.size(); h++){
-					if(edges[h].end == edges[i].end){
-						numW++;
-					}
-				}
-				
-				if(numW == 1){
-					WS.push_back(edges[i].end);
-					continue;
+		for(unsigned int k = succStart[v]; k < succStart[v+1]; k++){
+			unsigned int i = succEdges[k];
+			//EXIT -> ENTRY is never instrumented
+			if(i == needIndex)
+				continue;
+
+			//if e is chord edge
+			if(chordOf[i] != -1){
+				regInstr[i] = R_SET;
+				instrumentationR[i] = chordInc[chordOf[i]];
+				continue;
+			}
+			
+			//if e is the only incoming edge of w
+			unsigned int w = vertex(edges[i].end);
+			int numW = 0;
+			for(unsigned int h = predStart[w]; h < predStart[w+1]; h++){
+				if(predEdges[h] != needIndex){
+					numW++;
 				}
+			}
 			
-				//instrumentationR.push_back(0);
-				//corresEdgeR.push_back(edges[i]);
-				//else instrument (e, 'r=0')
-				//instrumentation,
+			if(numW == 1){
+				WS.push_back(w);
+				continue;
 			}
+		
+			//else instrument (e, 'r=0')
+			regInstr[i] = R_SET;
+			instrumentationR[i] = 0;
 		}
-
-      } //by default if edge is not a chord, assign r=0
-
+      }
 
 	  //Memory Increment Code
 	  //
@@ -1228,385 +899,1296 @@ namespace {
 	  //		else instrument(e, 'count[r]++');
 	  //}
 	 
-	  WS.push_back(BBList[BBList.size()-1]); //WS.add(EXIT)
+	  WS.push_back(vertex(NULL)); //WS.add(EXIT)
 	  while(!WS.empty()){
-		BasicBlock*	w = WS.back();
-		//errs() << "selected w: ";
-		//w->printAsOperand(errs(), false);
-		//errs() << "\n\n";	
-
-		//errs() << "size of working set: " << WS.size() << "\n\n";
-
+		unsigned int w = WS.back();
 		WS.pop_back();
 		
-		bool isChord = false;
-		int chordIndex = 0;
-		for(unsigned int i = 0; i < edges.size(); i++){
-			if(edges[i].end == w){	
-				//if e is chord edge
-				for(unsigned int y = 0; y < chords.size(); y++){ //dont want to count dummy backedge
-					if(edges[i].base == chords[y].base && edges[i].end == chords[y].end && edges[i].value == chords[y].value){
-						//instrumentation[y] = chordInc[y];
-
-						instrumentedChords.push_back(chords[y]);
-						isChord = true;
-						chordIndex = y;
-					}
-				}
-				
-				if(isChord){
-					//instrumentationR[chordIndex] = chordInc[chordIndex];
-					/*for(unsigned int n = 0; n < edges.size(); n++){
-						//find edges[i]'s instrumentation
-						if(edges[n].base == edges[i].base && edges[n].end == edges[i].end && corresEdgeR[n].value == edges[i].value){
-							//use 'n' to index instrumentationR
-							if(instrumentationR[n] == chordInc[chordIndex]){
-								instrumentationM[i] = (chordInc[chordIndex]);
-								//corresEdgeM.push_back(edges[i]);
-							}else{
-								instrumentationM[i] = (instrumentationR[n] + chordInc[chordIndex]);
-								corresEdgeM.push_back(edges[i]);
-							}
-						}
-					}*/
-					if(instrumentationR[i] == chordInc[chordIndex]){
-						instrumentationM[i] = chordInc[chordIndex]; 
-					}else{
-						instrumentationM[i] = instrumentationR[i] + chordInc[chordIndex];
-					}
-	
-					continue;
-				}
-				
-				//errs() << "w: ";
-				//edges[i].base->printAsOperand(errs(), false);
-				//errs() << "\n";
-				//if e is the only outgoing edge of v
-				int num = 0;
-				for(unsigned int h = 0; h < edges.size(); h++){
-					if(edges[h].base == edges[i].base){
-						num++;
-					}
+		for(unsigned int k = predStart[w]; k < predStart[w+1]; k++){
+			unsigned int i = predEdges[k];
+			if(i == needIndex)
+				continue;
+
+			//if e is chord edge
+			if(chordOf[i] != -1){
+				if(regInstr[i] == R_SET && instrumentationR[i] == chordInc[chordOf[i]]){
+					regInstr[i] = R_NONE;
+					memInstr[i] = M_COUNT_CONST;
+				}else{
+					memInstr[i] = M_COUNT_R;
 				}
-					
-				//errs() << "num: " << num << "\n";
-				if(num == 1){
-					WS.push_back(edges[i].base);
-					continue;
+				instrumentationM[i] = chordInc[chordOf[i]];
+				continue;
+			}
+			
+			//if e is the only outgoing edge of v
+			unsigned int v = vertex(edges[i].base);
+			int num = 0;
+			for(unsigned int h = succStart[v]; h < succStart[v+1]; h++){
+				if(succEdges[h] != needIndex){
+					num++;
 				}
-
-				//errs() << "corresEdgeR.size(): " << corresEdgeR.size() << "\n";			
+			}
 				
-				//errs() << "current edge: ";
-				//printEdge(edges[i]);
-				//errs() << "\n";
-
-
-				/*for(unsigned int n = 0; n < corresEdgeR.size(); n++){
-					printEdge(corresEdgeR[n]);
-					errs() << "\n";				
-
-					//find edges[i]'s instrumentation
-					if(corresEdgeR[n].base == edges[i].base && corresEdgeR[n].end == edges[i].end && corresEdgeR[n].value == edges[i].value){
-						errs() << "\ncorresEdgeR: ";
-						printEdge(corresEdgeR[n]);
-						errs() << "\n";
-						errs() << "r = " << instrumentationR[n] << "\n\n";
-						
-						instrumentationM[i] = (instrumentationR[n]);
-						//corresEdgeM.push_back(edges[i]);
-						break;
-					}
-				}*/
-				//instrumentationM[i] = instrumentationR[i];
+			if(num == 1){
+				WS.push_back(v);
+				continue;
 			}
-			//errs() << "instrumentions m[" << i << "] = " << instrumentationM[i] << "\n";
+
+			//else instrument (e, 'count[r]++')
+			memInstr[i] = M_COUNT_R;
+			instrumentationM[i] = 0;
 		}
-		
-	  }//by default
+	  }
 
 	  // Register increment code
 	  //
 	  //for all uninstrumented chords c
 	  //	instrument(c, 'r+=Inc(c)')
-	  if(!chords.empty()){	
-		  for(unsigned int i = 0; i < chords.size(); i++){
-			bool instrmd = false;
-			for(unsigned int j = 0; j < instrumentedChords.size(); j++){
-				if(chords[i].base == instrumentedChords[j].base && chords[i].end == instrumentedChords[j].end && chords[i].value == instrumentedChords[j].value){
-					instrmd = true;	
-				}
-			}	
+	  for(unsigned int i = 0; i < edges.size(); i++){
+		if(chordOf[i] != -1 && regInstr[i] == R_NONE && memInstr[i] == M_NONE){
+			regInstr[i] = R_ADD;
+			instrumentationR[i] = chordInc[chordOf[i]];
+		}
+	  }
 
-			if(!instrmd){
-				for(unsigned int k = 0; k < edges.size(); k++){
-					if(edges[k].base == chords[i].base && edges[k].end == chords[i].end && edges[k].value == chords[i].value){
-						instrumentationR[k] += chordInc[i];
-					}
-				}
-			}
-		  }
+	  //code needed on an edge without a place for it (indirectbr) can not be added
+	  Edge *stuck = NULL;
+	  for(unsigned int i = 0; i < numDAGEdges; i++){
+		if((regInstr[i] != R_NONE || memInstr[i] != M_NONE) && !canInstrumentEdge(edges[i].base, edges[i].end))
+			stuck = &edges[i];
 	  }
-	  /*int chordIndex = 0;
-	  vector<Edge> chordsToInstr;
-	  errs() << "chords size: " << chords.size() << "\n";
-	  if(chords.size() != 0){
-		  for(unsigned int x = 0; x < chords.size()-1; x++){
-			  bool chordInstrumented = false;
-			  for(unsigned int i = 0; i < corresEdgeM.size(); i++){
-				if(corresEdgeM[i].base == chords[x].base && corresEdgeM[i].end == chords[x].end && corresEdgeM[i].value == chords[x].value){
-					chordInstrumented = true;
-					chordIndex = x;
-				}
-			  }
-					
-			  if(!chordInstrumented){
-				for(unsigned int i = 0; i < corresEdgeR.size(); i++){
-					if(corresEdgeR[i].base == chords[x].base && corresEdgeR[i].end == chords[x].end && corresEdgeR[i].value == chords[x].value){
-						instrumentationR[i] = instrumentationR[i] + chordInc[x];
+	  //the dummies of a cut edge always end a path on it
+	  for(unsigned int i = 0; i < cutEdges.size(); i++){
+		if(!canInstrumentEdge(cutEdges[i].base, cutEdges[i].end))
+			stuck = &cutEdges[i];
+	  }
+	  if(stuck){
+		log << "Edge ";
+		printEdge(*stuck);
+		log << " can not be instrumented, skipping path profiling\n\n";
+		return;
+	  }
+	  pathProfiled = true;
+	}
+
+	// CS201 --- This function is run for each "basic block" in the input test file
+	bool runOnBasicBlock(BasicBlock &BB){
+      // CS201 --- outputting unique identifier for each encounter Basic Block
+	  log << "BasicBlock: ";
+	  BB.printAsOperand(log, false);
+	  log << '\n';
+
+	  log << '\n';	
+	  
+	  // CS201 --- loop iterates over each instruction in the current Basic Block and outputs the intermediate code
+	  for(auto &I: BB){
+	 	log << I << "\n";	
+	  }
+	  log << '\n';
+		
+	  return true;
+	}
+
+	//CS201 Helper Function - cs201_profile_function::cfgHash of F: the block count, then every CFG edge as (src, dst) in block and
+	//successor order, a returning block's edge going to EXIT (number n), and last EXIT -> entry
+	uint64_t computeCfgHash(){
+		uint64_t n = BBList.size();
+		uint64_t hash = hashValue(0xcbf29ce484222325ULL, n);
+		for(unsigned int b = 0; b < n; b++){
+			TerminatorInst *TI = BBList[b]->getTerminator();
+			for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+				hash = hashValue(hash, (uint64_t)b << 32 | BBIndex[TI->getSuccessor(i)]);
+			}
+			if(TI->getNumSuccessors() == 0)
+				hash = hashValue(hash, (uint64_t)b << 32 | n);
+		}
+		return hashValue(hash, n << 32);
+	}
+
+	//CS201 Helper Function - F's counts of an earlier run, if the profile has them for this CFG
+	void findPriorProfile(){
+		priorProfile = NULL;
+		auto prior = priorProfiles.find(hashName(name));
+		if(prior != priorProfiles.end() && prior->second.numBlocks == BBList.size() && prior->second.cfgHash == cfgHash){
+			priorProfile = &prior->second;
+		}
+	}
+
+	//CS201 Helper Function - sets up edgeWeight() for F: loop membership and block frequencies, or the counts of an earlier run
+	void computeBlockWeights(){
+		unsigned int n = BBList.size();
+		findPriorProfile();
+
+		//every loop around a block multiplies its frequency
+		blockFreq.resize(n);
+		for(unsigned int v = 0; v < n; v++){
+			blockFreq[v] = pow(LoopTripEstimate, (double)min(loopInfo.getLoopDepth(BBList[v]), MaxWeightedLoopDepth));
+		}
+	}
+
+	//CS201 Helper Function - static branch weight of the successor s of BBList[b]
+	double successorWeight(unsigned int b, BasicBlock *s){
+		if(isa<UnreachableInst>(s->getTerminator()))
+			return UnreachableWeight;
+
+		//leaving a loop is less likely than staying in it (taking the back edge included)
+		Loop *L = loopInfo.getLoopFor(BBList[b]);
+		if(L && !L->contains(s))
+			return 1;
+		return LoopStayWeight;
+	}
+
+	//CS201 Helper Function - estimated frequency of the edge u -> v (a NULL v is u leaving the function)
+	double edgeWeight(BasicBlock *u, BasicBlock *v){
+		unsigned int b = BBIndex[u];
+		if(priorProfile){
+			auto count = priorProfile->count.find((uint64_t)b << 32 | (v ? BBIndex[v] : BBList.size()));
+			return (count != priorProfile->count.end()) ? count->second : 0;
+		}
+		if(v == NULL)
+			return blockFreq[b];
+
+		//branch probability is the successor's share of the weights of all successors
+		TerminatorInst *TI = u->getTerminator();
+		double total = 0, share = 0;
+		for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+			double w = successorWeight(b, TI->getSuccessor(i));
+			total += w;
+			if(TI->getSuccessor(i) == v)
+				share += w;
+		}
+		return blockFreq[b] * share / total;
+	}
+
+	//CS201 Helper Function - loops without calls can only be left through their exit edges, so their edge counts are safe to keep
+	//in locals (registers, once promoted) that are added to the counters on those edges. Every edge into or out of the loop needs a place for code
+	void findAccumulatorLoops(){
+		for(unsigned int i = 0; i < loops.size(); i++){
+			bool local = true;
+			for(auto it = loops[i]->block_begin(); local && it != loops[i]->block_end(); ++it){
+				for(auto &I : **it){
+					if((isa<CallInst>(I) && !isa<IntrinsicInst>(I)) || isa<InvokeInst>(I)){
+						local = false;
 						break;
 					}
 				}
-			  }
-		  }
-	  }*/
+			}
+			for(unsigned int e = 0; local && e < cfgEdges.size(); e++){
+				Edge &edge = cfgEdges[e];
+				if(edge.end && loops[i]->contains(edge.base) != loops[i]->contains(edge.end) && !canInstrumentEdge(edge.base, edge.end))
+					local = false;
+			}
+			if(local)
+				accumulatorLoops.insert(loops[i]);
+		}
+	}
 
-	  //accesible data: edges, chords, chordInc (1 viewer members in chordInc than in chords), we dont use chords[chords.size()-1] 
+	//CS201 Helper Function - edge profiling of F (Knuth): only the chords of a spanning tree of the CFG are counted,
+	//the profile tool recovers the tree edges from flow conservation
+	void computeEdgeProfile(){
+		unsigned int n = BBList.size(); //number of the virtual EXIT block
 
-	
-	  //bbCounter = new GlobalVariable(M, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "bbCounter");
-	  /*for(unsigned int i = 0; i < corresEdgeR.size(); i++){
+		for(unsigned int b = 0; b < n; b++){
+			TerminatorInst *TI = BBList[b]->getTerminator();
+			for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+				Edge edge{BBList[b], TI->getSuccessor(i), 0, i};
+				cfgEdges.push_back(edge);
+			}
+			if(TI->getNumSuccessors() == 0){
+				Edge edge{BBList[b], NULL, 0};
+				cfgEdges.push_back(edge);
+			}
+		}
 
-	  }*/
- 		
-	  //errs() << "corresEgdeR size: " << corresEdgeR.size() << "\n";
-	  //errs() << "instrumentationM size: " << instrumentationM.size() << "\n";
-	  //errs() << "instrumentationR size: " << instrumentationR.size() << "\n";
+		//maximal spanning tree, EXIT -> ENTRY can not be counted so it goes into the tree first
+		vector<double> weight(cfgEdges.size());
+		vector<unsigned> order(cfgEdges.size());
+		for(unsigned int i = 0; i < cfgEdges.size(); i++){
+			//edges that can not carry a counter are kept in the tree
+			bool instrumentable = !cfgEdges[i].end || canInstrumentEdge(cfgEdges[i].base, cfgEdges[i].end);
+			weight[i] = instrumentable ? edgeWeight(cfgEdges[i].base, cfgEdges[i].end) : HUGE_VAL;
+			order[i] = i;
+		}
+		stable_sort(order.begin(), order.end(), [&weight](unsigned a, unsigned b){ return weight[a] > weight[b]; });
+
+		DisjointSet sets(n + 1);
+		sets.merge(n, 0);
+		cfgChord.assign(cfgEdges.size(), false);
+		for(unsigned int i = 0; i < order.size(); i++){
+			Edge &e = cfgEdges[order[i]];
+			//an edge closing a cycle of the tree is a chord
+			cfgChord[order[i]] = !sets.merge(BBIndex[e.base], e.end ? BBIndex[e.end] : n);
+		}
+	}
+};
 
+namespace {
+
+  struct CS201PathProfiling : public ModulePass {
+    static char ID;
+    LLVMContext *Context;
+    CS201PathProfiling() : ModulePass(ID) {}
+	GlobalVariable *profileCounters = NULL; //every counter of the module, one packed [numCounters x i64] array
+	unsigned int numCounters = 0; //counters allocated so far in 'profileCounters'
+	GlobalVariable *pathTables = NULL; //path tables of the functions with too many paths for a counter each, shared by all threads
+	unsigned int numPathTableWords = 0; //i64 words allocated so far in 'pathTables'
+	vector<cs201_profile_function> profileFunctions; //profile record of every function, in module order (CS201Profile.h)
+	vector<cs201_profile_edge> profileEdges; //CFGs of the functions for edge profiling
+	vector<cs201_profile_dag_edge> profileDagEdges; //path numbering DAGs of the path profiled functions, to decode their paths
+	vector<uint32_t> profileBlockNames; //block names of the path profiled functions
+	string profileNames; //name table of the profile
+	GlobalVariable *sharedProfileCounters = NULL; //shared copy the per-thread 'profileCounters' are merged into, in 'tls' counter mode
+	GlobalVariable *shardKey = NULL; //thread local byte whose address picks a thread's shard, in 'sharded' counter mode
+	GlobalVariable *shardStride = NULL; //distance between two shards of 'profileCounters', in 'sharded' counter mode
+	Function *mergeFunc = NULL; //merges the calling thread's counters into the shared ones, in 'tls' counter mode
+	map<uint64_t, PriorEdges> priorProfiles; //edge counts of an earlier run by function hash (-path-profiling-weights)
+	unique_ptr<Regex> functionRegex; //-path-profiling-functions, NULL if not given
+	set<string> functionList; //-path-profiling-function-list
+	bool selectFunctions = false; //only the functions the regex or the list name are instrumented
+
+
+    //---------------------------------- CS201 --- This function is run once at the beginning of execution. We just initialize our variables/structures here.
+    bool doInitialization(Module &M) {
+	  errs() << "\n----------Starting Path Profiling----------------\n";
+	  Context = &M.getContext();
+
+	  loadFunctionFilters();
+	  if(!ProfileUseFile.empty()){
+		//nothing is instrumented
+		loadPriorProfiles(ProfileUseFile, "leaving the module unannotated");
+		return true;
+	  }
+	  if(!EdgeWeightsFile.empty()){
+		loadPriorProfiles(EdgeWeightsFile, "using static edge weights");
+	  }
+
+	  //the number of path counters is only known once every function was seen, so counters are addressed through a
+	  //size-less placeholder that doFinalization replaces with the real array
+	  GlobalValue::ThreadLocalMode counterTLS = (CounterUpdates == CM_TLS) ? GlobalValue::InitialExecTLSModel : GlobalValue::NotThreadLocal;
+	  ArrayType *placeholderType = ArrayType::get(Type::getInt64Ty(*Context), 0);
+	  profileCounters = new GlobalVariable(M, placeholderType, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(placeholderType), "profileCounters", NULL, counterTLS);
+	  pathTables = new GlobalVariable(M, placeholderType, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(placeholderType), "pathTables");
+
+	  if(CounterUpdates == CM_SHARDED){
+		shardKey = new GlobalVariable(M, Type::getInt8Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt8Ty(*Context), 0), "shardKey", NULL, GlobalValue::InitialExecTLSModel);
+		//constant once the stride is known, so optimisations fold the load away
+		shardStride = new GlobalVariable(M, Type::getInt32Ty(*Context), true, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "shardStride");
+	  }else if(CounterUpdates == CM_TLS){
+		sharedProfileCounters = new GlobalVariable(M, placeholderType, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(placeholderType), "sharedProfileCounters");
+		//body is filled in at doFinalization, once every counter exists
+		mergeFunc = Function::Create(FunctionType::get(Type::getVoidTy(*Context), false), GlobalValue::InternalLinkage, "mergeThreadCounters", &M);
+	  }
 	
-	  //Module* module = F.getParent();
-	  //for(unsigned int i = 0; i < edges.size(); i++){
-		//pathCounters.push_back(new GlobalVariable(*module, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "pathCounter"));
-	  //}
+      return true;
+    }
 
+    //---------------------------------- CS201 --- This function is run once at the end of execution.
+    bool doFinalization(Module &M) {
+	  if(ProfileUseFile.empty()){
+		finalizeCounters(M);
+	  }
 
-	  //errs() << "path counters size: " << pathCounters.size() << "\n";
+	  errs() << "-----------Finished Path Profiling-------------------\n";
+      return true;
+    }
 
-	  /*for(unsigned int i = 0; i < edges.size(); i++){
-		errs() << instrumentationM[i] << "\n";
+    //---------------------------------- CS201 --- Functions are analysed in parallel, then instrumented one after the other in module order
+    bool runOnModule(Module &M) override {
+	  vector<Function*> selected;
+	  for(auto &F : M){
+		if(!F.isDeclaration() && shouldInstrument(F))
+			selected.push_back(&F);
 	  }
-	  errs() << "\n";
-	  */
 
-	  //for(unsigned int i = 0; i < edges.size(); i++){
-		//errs() << instrumentationR[i] << "\n";
-	  //}
-	  //errs() << "\n";
+	  vector<unique_ptr<FunctionContext>> contexts;
+	  for(unsigned int i = 0; i < selected.size(); i++){
+		Function *F = selected[i];
+		string name = F->getName().str();
+		bool sampled = SampleInterval > 1 && ProfileUseFile.empty() && canSample(*F);
+		if(sampled){
+			F = addSampledClone(*F);
+		}
+		//block names are part of the output, so they are set before any analysis. Profile use prints no blocks and keeps their names
+		if(ProfileUseFile.empty())
+			nameBlocks(*F);
+		contexts.push_back(unique_ptr<FunctionContext>(new FunctionContext(F, name, priorProfiles)));
+		if(sampled)
+			contexts.back()->sampleInterval = SampleInterval;
+	  }
 
-	  int i = 0;
-	  for(auto &BB: F){
-		//runOnBasicBlock(BB);
-		if(&BB == BBList[0]){	
-		  //Module* module = F.getParent();
-		  //for(unsigned int i = 0; i < edges.size(); i++){
-			//errs() << "i: " << i << "\n";
-			//pathCounters.push_back(new GlobalVariable(*module, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "pathCounter"));
-		  //}
-			
-		  //r = new GlobalVariable(*module, Type::getInt32Ty(*Context), false, GlobalValue::InternalLinkage, ConstantInt::get(Type::getInt32Ty(*Context), 0), "register");
+	  analyzeFunctions(contexts);
 
+	  for(unsigned int i = 0; i < contexts.size(); i++){
+		if(ProfileUseFile.empty()){
+			instrumentFunction(*contexts[i]);
+		}else{
+			applyProfile(*contexts[i]);
 		}
-		
-		//if(r
-		
-		for(auto &I: BB){
-			//at each edge, 
-			if(isa<BranchInst>(I)){
-				for(unsigned int i = 0; i < cast<BranchInst>(I).getNumSuccessors(); i++){
-					for(unsigned int j = 0; j < edges.size(); j++){
-						//bool skip = false;
-						//we are at the edge
-						if((edges[j].base == &BB) && (edges[j].end == cast<BranchInst>(I).getSuccessor(i))){
-							
-							//for(unsigned int z = 0; z < chords.size()-1; z++){
-							//	if(chords[z].base == edges[j].base && chords[z].end == edges[j].end && chords[z].value == edges[j].value){
-									
-									/*IRBuilder<> IRB(&I);
-									Value *loadAddr = IRB.CreateLoad(r);
-									Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), chordInc[j]), loadAddr);
-									IRB.CreateStore(addAddr, r);
-									skip = true;*/
-							//	}
-							//}
-							//if(edges[j].base =
-							//if(skip){
-							//	continue;
-							//} 
-							
-							
-							/*if(cast<BranchInst>(I).getNumSuccessors() == 1){
-								IRBuilder<> IRB(&I);
-								Value *loadAddr = IRB.CreateLoad(pathCounters[j]);
-								Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), instrumentationR[j]), loadAddr);
-								IRB.CreateStore(addAddr, pathCounters[j]);
-							}else{
-								IRBuilder<> IRB(cast<BranchInst>(I).getSuccessor(i)->getFirstInsertionPt());
-								Value *loadAddr = IRB.CreateLoad(pathCounters[j]);
-								Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt32Ty(*Context), instrumentationR[j]), loadAddr);
-								IRB.CreateStore(addAddr, pathCounters[j]);
-							}*/
-
-						}
-					}
+		contexts[i].reset();
+	  }
+      return true;
+    }
 
-				}
+	//CS201 Helper Function - reads -path-profiling-functions and -path-profiling-function-list, a bad one selects nothing
+	void loadFunctionFilters(){
+		if(!FunctionRegex.empty()){
+			selectFunctions = true;
+			functionRegex.reset(new Regex(FunctionRegex));
+			string error;
+			if(!functionRegex->isValid(error)){
+				errs() << "Invalid function regex " << FunctionRegex << ": " << error << "\n";
+				functionRegex.reset();
 			}
 		}
 
-		if(F.getName().equals("main") && isa<ReturnInst>(BB.getTerminator())){
-		   //for(unsigned int i = 0; i < pathCounters.size(); i++){
-		
-				/*vector<int> distinct;
-				for(unsigned int t = 0; t < instrumentationR.size(); t++){
-					if(distinct.empty()){
-						distinct.push_back(instrumentationR[t]);
-						continue;
-					}
-					
-					bool add = true;
-					for(unsigned int a = 0; a < distinct.size(); a++){
-						if(instrumentationR[t] == distinct[a]){
-							add = false;	
-						}
-					}
+		if(!FunctionListFile.empty()){
+			selectFunctions = true;
+			ifstream in(FunctionListFile.c_str());
+			if(!in){
+				errs() << "Can not read " << FunctionListFile << "\n";
+			}
+			//one name per line, blank lines and '#' comments are skipped
+			string line;
+			while(getline(in, line)){
+				StringRef name = StringRef(line).trim();
+				if(!name.empty() && !name.startswith("#"))
+					functionList.insert(name.str());
+			}
+		}
+	}
 
-					if(add){
-						distinct.push_back(instrumentationR[t]);
-					}
-				}	
-				//need to reconstruct path - part 4 of ball larus
-				//int R
-				for(unsigned int t = 0; t < edges.size(); t++){
-					if(edges[t].base == BBList[0]){//starting at entry node
-							
-					}
-				}*/
-	
-				/*string result = "";
-				if(i == 0){
-					result = "PATH PROFILING:\n";
-				}*/	
-			
-				//const char *base = (edges[i].base->getName().str()).c_str();
-				//if(loops[0][0]->getName().str() == "b"){
-				//	result = result + "Path_" + loops[0][0]->getName().str() + "0_0: "; 
-				//}/*else if(old_edges[i].end->getName().str() == "b"){
-				//	result = result + old_edges[i].base->getName().str() + " -> " + old_edges[i].end->getName().str() + "0: %d\n"; 
-				//}else{
-				//	result = result + old_edges[i].base->getName().str() + " -> " + old_edges[i].end->getName().str() + ": %d\n"; 
-				//}*/
-				
-				//if(instrumentationR[i] != 0){
-				//if(!loops.empty()){
-				//	errs() << "loops size: " << loops.size() << "\n";
-				//	for(unsigned int i = 0; i < loops.size(); i++){
-			
-				//result = result + "%d\n";
-					//}
-				//}
+	//CS201 Helper Function - whether F is instrumented: it is named by the regex or the list (if given) and is not too small
+	bool shouldInstrument(Function &F){
+		if(F.size() < MinBlocks)
+			return false;
+		if(!selectFunctions)
+			return true;
+		return (functionRegex && functionRegex->match(F.getName())) || functionList.count(F.getName().str());
+	}
 
-				/*const char *finalPrintString = result.c_str();//" -> : %d\n"; 
-				Constant *format_const = ConstantDataArray::getString(*Context, finalPrintString);
-				BasicBlockPrintfFormatStr = new GlobalVariable(*(F.getParent()), llvm::ArrayType::get(llvm::IntegerType::get(*Context, 8), strlen(finalPrintString)+1), true, llvm::GlobalValue::PrivateLinkage, format_const, "BasicBlockPrintfFormatStr");
-				//printf_func = printf_prototype(*Context, &M);
+	//CS201 Helper Function - a call to F can be forwarded to a clone unchanged (no varargs, no arguments living in the caller's frame),
+	//and F's blocks can be cloned: a blockaddress of one of them (computed goto) would still point into F, not into the clone
+	bool canSample(Function &F){
+		if(F.isVarArg() || F.getAttributes().hasAttrSomewhere(Attribute::InAlloca))
+			return false;
+		for(auto &BB : F){
+			if(BB.hasAddressTaken())
+				return false;
+		}
+		return true;
+	}
 
-				//addFinalPrintf(BB, Context, edgeCounters[i], BasicBlockPrintfFormatStr, printf_func);
-				addFinalPrintf(BB, Context, r, BasicBlockPrintfFormatStr, printf_func);*/
-				
-		   //}
+	//CS201 Helper Function - sampling gate: F gets an internal clone to instrument, and F itself counts its calls down in a thread
+	//local and forwards every SampleInterval-th one to the clone. Returns the clone
+	Function* addSampledClone(Function &F){
+		Module *M = F.getParent();
+		ValueToValueMapTy VMap;
+		Function *clone = CloneFunction(&F, VMap, false);
+		clone->setName(F.getName() + ".profiled");
+		clone->setLinkage(GlobalValue::InternalLinkage);
+		M->getFunctionList().push_back(clone);
+
+		Type *i32 = Type::getInt32Ty(*Context);
+		GlobalVariable *countdown = new GlobalVariable(*M, i32, false, GlobalValue::InternalLinkage, ConstantInt::get(i32, SampleInterval), F.getName() + ".sampleCountdown", NULL, GlobalValue::InitialExecTLSModel);
+
+		//the gate goes after the entry block's allocas, so they stay static
+		BasicBlock *gate = &F.getEntryBlock();
+		BasicBlock::iterator body = gate->begin();
+		while(isa<AllocaInst>(&*body))
+			++body;
+		BasicBlock *original = gate->splitBasicBlock(body);
+		BasicBlock *sampled = BasicBlock::Create(*Context, "sampled", &F, original);
+
+		gate->getTerminator()->eraseFromParent();
+		IRBuilder<> IRB(gate);
+		Value *left = IRB.CreateSub(IRB.CreateLoad(countdown), ConstantInt::get(i32, 1));
+		Value *sample = IRB.CreateICmpEQ(left, ConstantInt::get(i32, 0));
+		IRB.CreateStore(IRB.CreateSelect(sample, ConstantInt::get(i32, SampleInterval), left), countdown);
+		IRB.CreateCondBr(sample, sampled, original);
+
+		IRBuilder<> SampledIRB(sampled);
+		vector<Value*> args;
+		for(auto arg = F.arg_begin(); arg != F.arg_end(); ++arg){
+			args.push_back(&*arg);
+		}
+		CallInst *call = SampledIRB.CreateCall(clone, args);
+		call->setCallingConv(F.getCallingConv());
+		//byval copies live in F's frame, a tail call must not pass them on
+		bool byValArgs = false;
+		for(auto arg = F.arg_begin(); arg != F.arg_end(); ++arg){
+			byValArgs = byValArgs || arg->hasByValOrInAllocaAttr();
 		}
+		if(!byValArgs)
+			call->setTailCall();
+		if(F.getReturnType()->isVoidTy())
+			SampledIRB.CreateRetVoid();
+		else
+			SampledIRB.CreateRet(call);
+		return clone;
+	}
 
-		i++;
+	//CS201 Helper Function - names the blocks of F "b", LLVM numbers the duplicates (b1, b2, ...) and the first one becomes "b0"
+	void nameBlocks(Function &F){
+	  for(auto &BB: F){
+		BB.setName("b");
 	  }
-	  
-	  /*errs() << "Outputting Maximal Spanning Tree:\n";
-	  for(unsigned int i = 0; i < MST.size(); i++){
-		  printEdge(MST[i]);
-	  	  errs() << "\n";
-  	  }
-	  errs() << "\n";*/
-
-	  /*errs() << "Outputting chords: \n";
-	  for(unsigned int i = 0; i < chords.size(); i++){
-		  printEdge(chords[i]);
-	  	  errs() << "\n";
-  	  }
-	  errs() << "\n";
-
-	  errs() << "Printed out DAG edges" << "\n";
-	  for(unsigned int i = 0; i < edges.size(); i++){
-		  printEdge(edges[i]);
-		  errs() << "\n";
+
+	  //attempts to fine tune basic block name for 'b0'
+	  for(auto &BB: F){
+		if(BB.getName() == "b"){
+			BB.setName("b0");
+			break;
+		}	
 	  }
-	  errs() << "\n";
-	
+	}
 
-	  //check that dominator sets are correct
-	  //printFuncDomSets(funcDomSet);*/
-
-	  //check that basic blocks stored in correct order (Use the below commented code to see the BasicBlock identifer mappings)
-	  /*errs() << "BBList size (" << BBList.size() << ")\n";
-	  for(unsigned int q = 0; q < BBList.size(); q++){
-	  	BBList[q]->printAsOperand(errs(), false);
-		errs() << " -> b" << q << "\n";		
-	  }*/
-
-	  //empty BBList for use in next function
-	  BBList.clear();
-	  edges.clear();
-	  old_edges.clear();
-	  loops.clear();
-	
-      return true;
-    }
-	
-	// CS201 --- This function is run for each "basic block" in the input test file
-	bool runOnBasicBlock(BasicBlock &BB){
-      // CS201 --- outputting unique identifier for each encounter Basic Block
-	  errs() << "BasicBlock: ";
-	  BB.printAsOperand(errs(), false);
-	  errs() << '\n';
+	//CS201 Helper Function - runs FunctionContext::analyze on a pool of threads (-path-profiling-threads), each takes the next
+	//function not yet taken. analyze() only reads the IR, so no lock is needed
+	void analyzeFunctions(vector<unique_ptr<FunctionContext>> &contexts){
+		unsigned int numThreads = AnalysisThreads ? (unsigned int)AnalysisThreads : thread::hardware_concurrency();
+		numThreads = max(1u, min(numThreads, (unsigned int)contexts.size()));
 
-	  // CS201 --- These 4 lines incremented bbCounter each time a basic block was accessed in the real-time execution of the input program
-	  // The code to increment the edge and path counters will be very similiar to this code 
-	  
+		atomic<unsigned> next(0);
+		auto worker = [&contexts, &next](){
+			for(unsigned i = next++; i < contexts.size(); i = next++){
+				contexts[i]->analyze();
+			}
+		};
 
-	  errs() << '\n';	
-	  
-	  // CS201 --- loop iterates over each instruction in the current Basic Block and outputs the intermediate code
-	  for(auto &I: BB){
-	 	errs() << I << "\n";	
+		//the calling thread is one of the workers
+		vector<thread> workers;
+		for(unsigned int t = 1; t < numThreads; t++){
+			workers.push_back(thread(worker));
+		}
+		worker();
+		for(unsigned int t = 0; t < workers.size(); t++){
+			workers[t].join();
+		}
+	}
+
+	//CS201 Helper Function - prints what was found about a function and adds its edge and path instrumentation
+	void instrumentFunction(FunctionContext &ctx){
+	  errs() << ctx.log.str();
+
+	  //the path register and the loop edge counts start out as stack slots, turned into SSA values (phis at merges) once every use is in place
+	  vector<AllocaInst*> locals;
+	  addEdgeProfile(ctx, locals);
+	  if(ctx.pathProfiled){
+		addPathProfile(ctx, locals);
+	  }
+
+	  //blocks were split for the instrumentation, so the dominator tree is recomputed
+	  DominatorTree domTree;
+	  domTree.recalculate(*ctx.F);
+	  vector<AllocaInst*> promotable;
+	  for(unsigned int i = 0; i < locals.size(); i++){
+		if(isAllocaPromotable(locals[i]))
+			promotable.push_back(locals[i]);
+	  }
+	  if(!promotable.empty()){
+		PromoteMemToReg(promotable, domTree);
 	  }
-	  errs() << '\n';
-		
-	  return true;
 	}
 
+	//CS201 Helper Function - adds the path register and path counter updates of a path profiled function
+	void addPathProfile(FunctionContext &ctx, vector<AllocaInst*> &locals){
+	  //Adding the instrumentation to the program
+	  //the path register lives in a stack slot of the function, the path counters in the function's slice of the module's counter array,
+	  //or in its path table if there are too many paths
+	  unsigned int pathBase = 0;
+	  uint32_t pathTable = CS201_PROFILE_NONE;
+	  if((uint64_t)ctx.numPaths > PathTableThreshold){
+		pathTable = allocatePathTable();
+		profileFunctions.back().pathTable = pathTable;
+		profileFunctions.back().pathTableSlots = pathTableSlots();
+	  }else{
+		pathBase = allocateCounters(ctx.numPaths);
+		profileFunctions.back().counterBase = pathBase;
+	  }
+	  profileFunctions.back().numPaths = ctx.numPaths;
+	  addPathNumbering(ctx);
+
+	  IRBuilder<> EntryIRB(&*ctx.F->getEntryBlock().getFirstInsertionPt());
+	  AllocaInst *pathReg = EntryIRB.CreateAlloca(Type::getInt64Ty(*Context), 0, "pathReg");
+	  locals.push_back(pathReg);
+
+	  //loop regions with few paths count them in a local array of the function, never shared with another thread
+	  vector<AllocaInst*> regionCounts(ctx.regions.size(), NULL);
+	  for(unsigned int r = 0; r < ctx.regions.size() && pathTable == CS201_PROFILE_NONE; r++){
+		if(ctx.regionPaths(r) <= LoopRegionMaxPaths)
+			regionCounts[r] = EntryIRB.CreateAlloca(ArrayType::get(Type::getInt64Ty(*Context), ctx.regionPaths(r)), 0, "regionCounts");
+	  }
+
+	  //real edges of the DAG ('r += Inc(e)' of large switches is added through a table instead)
+	  for(unsigned int i = 0; i < ctx.numDAGEdges; i++){
+		RegInstr reg = ctx.regInstr[i];
+		if(reg == R_ADD && usesSwitchTable(ctx.edges[i].base->getTerminator()))
+			reg = R_NONE;
+		int64_t base;
+		AllocaInst *counts = getRegionCounts(ctx, regionCounts, ctx.blockRegion[ctx.BBIndex[ctx.edges[i].base]], pathBase, base);
+		addPathInstr(getEdgeInsertPt(ctx.edges[i]), pathReg, base, pathTable, counts, reg, ctx.instrumentationR[i], ctx.memInstr[i], ctx.instrumentationM[i]);
+	  }
 
-	// CS201 --- We will have to play with these "Printf" functions to output the "profiled program" output a little later	
+	  //a cut edge ends the path through its EXIT dummy and starts a new one through its ENTRY dummy. Leaving a loop region adds its
+	  //local counts to the counters, entering one clears them
+	  for(unsigned int i = 0; i < ctx.cutEdges.size(); i++){
+		Instruction *insertPt = getEdgeInsertPt(ctx.cutEdges[i]);
+		int x = ctx.exitDummy[i];
+		int n = ctx.entryDummy[i];
+		int from = ctx.blockRegion[ctx.BBIndex[ctx.cutEdges[i].base]];
+		int into = ctx.blockRegion[ctx.BBIndex[ctx.cutEdges[i].end]];
+
+		int64_t base;
+		AllocaInst *counts = getRegionCounts(ctx, regionCounts, from, pathBase, base);
+		addPathInstr(insertPt, pathReg, base, pathTable, counts, ctx.regInstr[x], ctx.instrumentationR[x], ctx.memInstr[x], ctx.instrumentationM[x]);
+		if(counts && from != into)
+			addRegionFlush(insertPt, counts, pathBase + ctx.regionFirstPath(from));
+
+		counts = getRegionCounts(ctx, regionCounts, into, pathBase, base);
+		if(counts && from != into)
+			addRegionReset(insertPt, counts);
+		addPathInstr(insertPt, pathReg, base, pathTable, counts, ctx.regInstr[n], ctx.instrumentationR[n], ctx.memInstr[n], ctx.instrumentationM[n]);
+	  }
 
-	//needed to print the bbCounter at end of main
-	void addFinalPrintf(BasicBlock& BB, LLVMContext *Context, GlobalVariable *bbCounter, GlobalVariable *var, Function *printf_func){
-	  IRBuilder<> builder(BB.getTerminator());
-	  vector<Constant*> indices;
-	  Constant *zero = Constant::getNullValue(IntegerType::getInt32Ty(*Context));
-	  indices.push_back(zero);
-	  indices.push_back(zero);
-	  Constant *var_ref = ConstantExpr::getGetElementPtr(var, indices);
-	
-	  Value *bbc = builder.CreateLoad(bbCounter);
-	  CallInst *call = builder.CreateCall2(printf_func, var_ref, bbc);
-	  call->setTailCall(false); 
+	  //leaves end their paths right before returning
+	  for(unsigned int i = 0; i < ctx.leafDummy.size(); i++){
+		int l = ctx.leafDummy[i];
+		if(isa<ReturnInst>(ctx.edges[l].base->getTerminator())){
+			addPathInstr(ctx.edges[l].base->getTerminator(), pathReg, pathBase, pathTable, NULL, ctx.regInstr[l], ctx.instrumentationR[l], ctx.memInstr[l], ctx.instrumentationM[l]);
+		}
+	  }
+
+	  //last, so the table's increment comes after any code placed at the start of the switch's block
+	  for(unsigned int i = 0; i < ctx.BBList.size(); i++){
+		if(usesSwitchTable(ctx.BBList[i]->getTerminator()))
+			addSwitchIncrementTable(ctx, cast<SwitchInst>(ctx.BBList[i]->getTerminator()), pathReg);
+	  }
+	}
+
+	//CS201 Helper Function - where code for edge e goes: the end of its source or the start of its target if either is only on e,
+	//else a block of its own. Critical edges are only split here, once code for them turns up
+	Instruction* getEdgeInsertPt(Edge &e){
+		TerminatorInst *TI = e.base->getTerminator();
+		if(TI->getNumSuccessors() == 1){
+			return TI;
+		}
+
+		//once e was split its successor is the new block
+		BasicBlock *succ = TI->getSuccessor(e.succ);
+		if(succ->getSinglePredecessor() == e.base){
+			return &*succ->getFirstInsertionPt();
+		}
+
+		if(succ->isLandingPad()){
+			//an unwind edge gets a landing pad of its own instead
+			SmallVector<BasicBlock*, 2> newBBs;
+			SplitLandingPadPredecessors(succ, e.base, ".lp", ".lprest", this, newBBs);
+			return &*newBBs[0]->getFirstInsertionPt();
+		}
+		//indirectbr edges can not be split, canInstrumentEdge keeps code off them
+		return SplitCriticalEdge(TI, e.succ, this)->getTerminator();
+	}
+
+
+	//CS201 Helper Function - smallest and largest case value of a switch
+	void getCaseRange(SwitchInst *SI, int64_t &low, int64_t &high){
+		low = INT64_MAX;
+		high = INT64_MIN;
+		for(SwitchInst::CaseIt c = SI->case_begin(); c != SI->case_end(); ++c){
+			int64_t v = c.getCaseValue()->getSExtValue();
+			low = min(low, v);
+			high = max(high, v);
+		}
+	}
+
+	//CS201 Helper Function - true for a switch large and dense enough for addSwitchIncrementTable
+	bool usesSwitchTable(TerminatorInst *TI){
+		SwitchInst *SI = dyn_cast<SwitchInst>(TI);
+		if(!SI || SI->getNumCases() < SwitchTableMinCases || SI->getCondition()->getType()->getIntegerBitWidth() > 64)
+			return false;
+
+		int64_t low, high;
+		getCaseRange(SI, low, high);
+		return (uint64_t)high - (uint64_t)low < (uint64_t)SwitchTableDensity * SI->getNumCases();
+	}
+
+	//CS201 Helper Function - 'r += Inc(e)' of every edge of a switch as one load from a constant table indexed by the case value
+	void addSwitchIncrementTable(FunctionContext &ctx, SwitchInst *SI, AllocaInst *pathReg){
+		//edges without a register increment (tree edges, back edges) add 0, edges are told apart by successor number as
+		//the successor of a split edge is its new block
+		unsigned int b = ctx.BBIndex[SI->getParent()];
+		DenseMap<unsigned, int64_t> inc;
+		for(unsigned int k = ctx.succStart[b]; k < ctx.succStart[b+1]; k++){
+			unsigned int i = ctx.succEdges[k];
+			if(i < ctx.numDAGEdges && ctx.regInstr[i] == R_ADD)
+				inc[ctx.edges[i].succ] = ctx.instrumentationR[i];
+		}
+		if(inc.empty())
+			return;
+
+		//slot 'v - low' holds the increment of case v, the gaps and the last slot hold the default's
+		int64_t low, high;
+		getCaseRange(SI, low, high);
+		uint64_t range = (uint64_t)high - (uint64_t)low + 1;
+		vector<Constant*> table(range + 1, ConstantInt::get(Type::getInt64Ty(*Context), inc.lookup(0)));
+		for(SwitchInst::CaseIt c = SI->case_begin(); c != SI->case_end(); ++c){
+			table[(uint64_t)c.getCaseValue()->getSExtValue() - (uint64_t)low] = ConstantInt::get(Type::getInt64Ty(*Context), inc.lookup(c.getSuccessorIndex()));
+		}
+		ArrayType *tableType = ArrayType::get(Type::getInt64Ty(*Context), table.size());
+		GlobalVariable *incTable = new GlobalVariable(*SI->getParent()->getParent()->getParent(), tableType, true, GlobalValue::PrivateLinkage, ConstantArray::get(tableType, table), "switchIncs");
+
+		IRBuilder<> IRB(SI);
+		Value *slot = IRB.CreateSub(IRB.CreateSExt(SI->getCondition(), Type::getInt64Ty(*Context)), ConstantInt::get(Type::getInt64Ty(*Context), low, true));
+		Value *inRange = IRB.CreateICmpULT(slot, ConstantInt::get(Type::getInt64Ty(*Context), range));
+		slot = IRB.CreateSelect(inRange, slot, ConstantInt::get(Type::getInt64Ty(*Context), range));
+		Value *indices[] = {ConstantInt::get(Type::getInt32Ty(*Context), 0), slot};
+		Value *loadAddr = IRB.CreateLoad(pathReg);
+		Value *addAddr = IRB.CreateAdd(IRB.CreateLoad(IRB.CreateInBoundsGEP(incTable, indices)), loadAddr);
+		IRB.CreateStore(addAddr, pathReg);
+	}
+
+	//CS201 Helper Function - the counters the paths of loop region r go to: its local counts if it has them, with 'base' the index of
+	//path 0 in them (negative, path 0 is not a path of the region), else the function's counters from 'pathBase'
+	AllocaInst* getRegionCounts(FunctionContext &ctx, vector<AllocaInst*> &regionCounts, int r, unsigned int pathBase, int64_t &base){
+		if(r == -1 || !regionCounts[r]){
+			base = pathBase;
+			return NULL;
+		}
+		base = -ctx.regionFirstPath(r);
+		return regionCounts[r];
+	}
+
+	//CS201 Helper Function - adds the local counts of a loop region to its paths' counters, from 'firstCounter' on
+	void addRegionFlush(Instruction* insertPt, AllocaInst* regionCounts, unsigned int firstCounter){
+		IRBuilder<> IRB(insertPt);
+		unsigned int n = regionCounts->getAllocatedType()->getArrayNumElements();
+		for(unsigned int k = 0; k < n; k++){
+			Value *indices[] = {ConstantInt::get(Type::getInt32Ty(*Context), 0), ConstantInt::get(Type::getInt32Ty(*Context), k)};
+			Value *count = IRB.CreateLoad(IRB.CreateInBoundsGEP(regionCounts, indices));
+			addCounterIncrement(IRB, ConstantInt::get(Type::getInt32Ty(*Context), firstCounter + k), count);
+		}
+	}
+
+	//CS201 Helper Function - clears the local counts of a loop region when it is entered
+	void addRegionReset(Instruction* insertPt, AllocaInst* regionCounts){
+		IRBuilder<> IRB(insertPt);
+		unsigned int n = regionCounts->getAllocatedType()->getArrayNumElements();
+		for(unsigned int k = 0; k < n; k++){
+			Value *indices[] = {ConstantInt::get(Type::getInt32Ty(*Context), 0), ConstantInt::get(Type::getInt32Ty(*Context), k)};
+			IRB.CreateStore(ConstantInt::get(Type::getInt64Ty(*Context), 0), IRB.CreateInBoundsGEP(regionCounts, indices));
+		}
+	}
+
+	//CS201 Helper Function - adds the DAG the paths of F are numbered on and its block names to the profile, so that path ids
+	//can be turned back into blocks (CS201Profile.h)
+	void addPathNumbering(FunctionContext &ctx){
+		//EXIT -> ENTRY is not part of the DAG
+		vector<uint32_t> kind(ctx.edges.size(), CS201_PROFILE_NONE);
+		for(unsigned int i = 0; i < ctx.numDAGEdges; i++){
+			kind[i] = CS201_DAG_REAL;
+		}
+		for(unsigned int i = 0; i < ctx.cutEdges.size(); i++){
+			kind[ctx.entryDummy[i]] = CS201_DAG_ENTRY;
+			kind[ctx.exitDummy[i]] = CS201_DAG_EXIT;
+		}
+		for(unsigned int i = 0; i < ctx.leafDummy.size(); i++){
+			kind[ctx.leafDummy[i]] = CS201_DAG_LEAF;
+		}
+
+		cs201_profile_function &function = profileFunctions.back();
+		function.firstDagEdge = profileDagEdges.size();
+		for(unsigned int i = 0; i < ctx.edges.size(); i++){
+			if(kind[i] == CS201_PROFILE_NONE)
+				continue;
+			cs201_profile_dag_edge rec = {ctx.vertex(ctx.edges[i].base), ctx.vertex(ctx.edges[i].end), ctx.edges[i].value, kind[i], 0};
+			profileDagEdges.push_back(rec);
+		}
+		function.numDagEdges = profileDagEdges.size() - function.firstDagEdge;
+
+		function.blockNames = profileBlockNames.size();
+		for(unsigned int v = 0; v < ctx.BBList.size(); v++){
+			profileBlockNames.push_back(addProfileName(blockLabel(ctx.BBList[v])));
+		}
+	}
+
+	//CS201 Helper Function - emits the register and counter instrumentation of one edge before 'insertPt'
+	//paths are counted in 'regionCounts' if it is not NULL, path p in slot 'pathBase + p' of the counters
+	void addPathInstr(Instruction* insertPt, AllocaInst* pathReg, int64_t pathBase, uint32_t pathTable, AllocaInst* regionCounts, RegInstr reg, int64_t regVal, MemInstr mem, int64_t memVal){
+		//'r=x' directly followed by 'count[r+y]++' is just 'count[x+y]++'
+		if(reg == R_SET && mem == M_COUNT_R){
+			reg = R_NONE;
+			mem = M_COUNT_CONST;
+			memVal = (int64_t)((uint64_t)memVal + regVal);
+		}
+
+		IRBuilder<> IRB(insertPt);
+		if(reg == R_SET){
+			IRB.CreateStore(ConstantInt::get(Type::getInt64Ty(*Context), regVal), pathReg);
+		}else if(reg == R_ADD){
+			Value *loadAddr = IRB.CreateLoad(pathReg);
+			Value *addAddr = IRB.CreateAdd(ConstantInt::get(Type::getInt64Ty(*Context), regVal), loadAddr);
+			IRB.CreateStore(addAddr, pathReg);
+		}
+
+		if(mem == M_NONE)
+			return;
+
+		if(pathTable != CS201_PROFILE_NONE){
+			Value *path = ConstantInt::get(Type::getInt64Ty(*Context), memVal);
+			if(mem == M_COUNT_R){
+				path = IRB.CreateAdd(IRB.CreateLoad(pathReg), path);
+			}
+			addPathTableIncrement(IRB, pathTable, path);
+			return;
+		}
+
+		//the counter index always fits in 32 bits, so the path is added in 32 bits too
+		Value *index = ConstantInt::get(Type::getInt32Ty(*Context), (uint64_t)(pathBase + memVal));
+		if(mem == M_COUNT_R){
+			index = IRB.CreateAdd(IRB.CreateTrunc(IRB.CreateLoad(pathReg), Type::getInt32Ty(*Context)), index);
+		}
+		if(regionCounts){
+			//only this thread ever sees a local
+			Value *indices[] = {ConstantInt::get(Type::getInt32Ty(*Context), 0), index};
+			Value *slot = IRB.CreateInBoundsGEP(regionCounts, indices);
+			IRB.CreateStore(IRB.CreateAdd(IRB.CreateLoad(slot), ConstantInt::get(Type::getInt64Ty(*Context), 1)), slot);
+			return;
+		}
+		addCounterIncrement(IRB, index);
+	}
+
+	//CS201 Helper Function - emits '__cs201_count_path(table, slots, path)', which counts 'path' in a path table (CS201ProfileRuntime.c)
+	void addPathTableIncrement(IRBuilder<> &IRB, uint32_t pathTable, Value *path){
+		Module *M = IRB.GetInsertBlock()->getParent()->getParent();
+		Type *countArgs[] = {Type::getInt64PtrTy(*Context), Type::getInt32Ty(*Context), Type::getInt64Ty(*Context)};
+		Constant *countPath = M->getOrInsertFunction("__cs201_count_path", FunctionType::get(Type::getVoidTy(*Context), countArgs, false));
+
+		Value *indices[] = {ConstantInt::get(Type::getInt32Ty(*Context), 0), ConstantInt::get(Type::getInt32Ty(*Context), pathTable)};
+		Value *table = IRB.CreateInBoundsGEP(pathTables, indices);
+		IRB.CreateCall3(countPath, table, ConstantInt::get(Type::getInt32Ty(*Context), pathTableSlots()), path);
+	}
+
+	//CS201 Helper Function - reads the edge counts of an earlier run (-path-profiling-weights or -use) into 'priorProfiles'
+	//'fallback' says what happens without them
+	void loadPriorProfiles(const string &file, const char *fallback){
+		vector<char> data;
+		if(!readProfileFile(file.c_str(), data)){
+			errs() << "Can not read " << file << ", " << fallback << "\n";
+			return;
+		}
+
+		size_t pos = 0;
+		while(pos < data.size()){
+			CS201ProfileModule m;
+			string error;
+			pos = readProfileModule(data, pos, m, error);
+			if(pos == 0){
+				errs() << file << ": " << error << ", " << fallback << "\n";
+				priorProfiles.clear();
+				return;
+			}
+
+			for(unsigned int f = 0; f < m.functions.size(); f++){
+				const cs201_profile_function &function = m.functions[f];
+				//internal functions of different modules may share a name, the first one wins
+				if(priorProfiles.count(function.hash))
+					continue;
+
+				vector<int64_t> value;
+				vector<bool> known;
+				recoverEdgeCounts(function, m.edges.data() + function.firstEdge, m.count, value, known);
+
+				PriorEdges &prior = priorProfiles[function.hash];
+				prior.numBlocks = function.numBlocks;
+				prior.cfgHash = function.cfgHash;
+				prior.sampleInterval = max(function.sampleInterval, 1u);
+				for(unsigned int e = 0; e < function.numEdges; e++){
+					const cs201_profile_edge &edge = m.edges[function.firstEdge + e];
+					if(known[e] && value[e] >= 0)
+						prior.count[(uint64_t)edge.src << 32 | edge.dst] += value[e];
+				}
+
+				if(SuperblockPaths == 0 || function.numDagEdges == 0)
+					continue;
+				vector<pair<uint64_t, uint64_t> > taken;
+				uint64_t lost;
+				takenPaths(m, function, taken, lost);
+				sortHottest(taken, SuperblockPaths);
+				CS201PathDecoder decoder(m, function);
+				for(unsigned int i = 0; i < taken.size() && i < SuperblockPaths; i++){
+					vector<uint32_t> blocks;
+					bool afterCut, beforeCut;
+					if(decoder.decode(taken[i].first, blocks, afterCut, beforeCut) && blocks.size() > 1)
+						prior.hotPaths.push_back(blocks);
+				}
+			}
+		}
+	}
+
+	//CS201 Helper Function - profile use (-path-profiling-use): the branch weights of every conditional branch and switch of F
+	//from its edge counts, and F's entry count. A function whose CFG changed since the profile is left alone
+	void applyProfile(FunctionContext &ctx){
+		if(!ctx.priorProfile){
+			errs() << "No profile for " << ctx.name << " with this CFG, left unannotated\n\n";
+			return;
+		}
+
+		unsigned int n = ctx.BBList.size();
+		MDBuilder MDB(*Context);
+		for(unsigned int b = 0; b < n; b++){
+			TerminatorInst *TI = ctx.BBList[b]->getTerminator();
+			BranchInst *BI = dyn_cast<BranchInst>(TI);
+			if(!(BI && BI->isConditional()) && !isa<SwitchInst>(TI))
+				continue;
+
+			//successors sharing a block share its edge count (the profile has one edge per successor, but they are summed when read)
+			vector<uint64_t> counts;
+			uint64_t largest = 0;
+			bool known = true;
+			for(unsigned int i = 0; i < TI->getNumSuccessors() && known; i++){
+				BasicBlock *succ = TI->getSuccessor(i);
+				auto count = ctx.priorProfile->count.find((uint64_t)b << 32 | ctx.BBIndex[succ]);
+				known = (count != ctx.priorProfile->count.end());
+				unsigned int shared = 0;
+				for(unsigned int j = 0; j < TI->getNumSuccessors(); j++){
+					if(TI->getSuccessor(j) == succ)
+						shared++;
+				}
+				counts.push_back(known ? count->second / shared : 0);
+				largest = max(largest, counts.back());
+			}
+			//a sampled profile not reaching a branch only says it is run less often than the sampling interval
+			if(!known || (largest == 0 && ctx.priorProfile->sampleInterval > 1))
+				continue;
+
+			//weights are 32 bits, and never 0 so a branch not taken in the profile is unlikely rather than impossible
+			uint64_t scale = largest / UINT32_MAX + 1;
+			vector<uint32_t> weights;
+			for(unsigned int i = 0; i < counts.size(); i++){
+				weights.push_back(counts[i] / scale + 1);
+			}
+			TI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(weights));
+		}
+
+		//LLVM has no entry count of its own yet: it goes into the module's cs201.entry_counts, and a function never called is cold.
+		//Sampled counts are scaled up to all calls, and a sampled function that was never counted may still have been called
+		auto entries = ctx.priorProfile->count.find((uint64_t)n << 32);
+		if(entries != ctx.priorProfile->count.end()){
+			unsigned int interval = ctx.priorProfile->sampleInterval;
+			uint64_t calls = (entries->second > UINT64_MAX / interval) ? UINT64_MAX : entries->second * interval;
+			Value *entryCount[] = {ctx.F, ConstantInt::get(Type::getInt64Ty(*Context), calls)};
+			ctx.F->getParent()->getOrInsertNamedMetadata("cs201.entry_counts")->addOperand(MDNode::get(*Context, entryCount));
+			if(calls == 0 && interval == 1)
+				ctx.F->addFnAttr(Attribute::Cold);
+		}
+
+		//copies keep the branch weights of their originals
+		unsigned int formed = 0;
+		for(unsigned int i = 0; i < ctx.priorProfile->hotPaths.size(); i++){
+			if(formSuperblock(ctx, ctx.priorProfile->hotPaths[i]))
+				formed++;
+		}
+		if(formed != 0)
+			errs() << "Formed " << formed << " superblocks in " << ctx.name << "\n\n";
+	}
+
+	//CS201 Helper Function - whether a block can be copied: no landing pad, indirectbr or noduplicate call, and its address is not taken
+	bool canDuplicate(BasicBlock *BB){
+		if(BB->isLandingPad() || BB->hasAddressTaken() || isa<IndirectBrInst>(BB->getTerminator()))
+			return false;
+		for(auto &I : *BB){
+			CallInst *CI = dyn_cast<CallInst>(&I);
+			if(CI && CI->cannotDuplicate())
+				return false;
+		}
+		return true;
+	}
+
+	//CS201 Helper Function - makes a superblock of a hot path (blocks by BBList position): the blocks from the first one with
+	//another predecessor on are copied, the path goes through the copies, and the copies branch to the originals when they leave
+	//the path. Values defined in the copied blocks get phis where both versions meet. Returns false if the path was left alone:
+	//an earlier superblock took one of its edges, or its tail is too big or can not be copied
+	bool formSuperblock(FunctionContext &ctx, const vector<uint32_t> &path){
+		vector<BasicBlock*> blocks;
+		for(unsigned int i = 0; i < path.size(); i++){
+			blocks.push_back(ctx.BBList[path[i]]);
+		}
+		for(unsigned int i = 1; i < blocks.size(); i++){
+			bool edge = false;
+			for(succ_iterator s = succ_begin(blocks[i-1]); s != succ_end(blocks[i-1]); ++s){
+				edge = edge || (*s == blocks[i]);
+			}
+			if(!edge)
+				return false;
+		}
+
+		unsigned int first = 1; //first block of the tail
+		while(first < blocks.size() && blocks[first]->getSinglePredecessor() == blocks[first-1])
+			first++;
+		if(first == blocks.size())
+			return false;
+		if(isa<IndirectBrInst>(blocks[first-1]->getTerminator()))
+			return false;
+		unsigned int size = 0;
+		for(unsigned int i = first; i < blocks.size(); i++){
+			if(!canDuplicate(blocks[i]))
+				return false;
+			size += blocks[i]->size();
+		}
+		if(size > SuperblockMaxInstrs)
+			return false;
+
+		//a copy has only the path as predecessor, so its phis become their value from the path
+		ValueToValueMapTy VMap;
+		vector<BasicBlock*> copies;
+		for(unsigned int i = first; i < blocks.size(); i++){
+			BasicBlock *copy = CloneBasicBlock(blocks[i], VMap, ".hot", ctx.F);
+			for(BasicBlock::iterator I = blocks[i]->begin(); isa<PHINode>(I); ++I){
+				PHINode *PN = cast<PHINode>(I);
+				Value *in = PN->getIncomingValueForBlock(blocks[i-1]);
+				ValueToValueMapTy::iterator mapped = VMap.find(in);
+				if(mapped != VMap.end())
+					in = mapped->second;
+				cast<Instruction>(VMap[PN])->eraseFromParent();
+				VMap[PN] = in;
+			}
+			copies.push_back(copy);
+		}
+		for(unsigned int c = 0; c < copies.size(); c++){
+			for(auto &I : *copies[c]){
+				RemapInstruction(&I, VMap, RF_IgnoreMissingEntries);
+			}
+		}
+
+		//the path goes into the copies
+		TerminatorInst *top = blocks[first-1]->getTerminator();
+		for(unsigned int i = 0; i < top->getNumSuccessors(); i++){
+			if(top->getSuccessor(i) == blocks[first]){
+				blocks[first]->removePredecessor(blocks[first-1], true);
+				top->setSuccessor(i, copies[0]);
+			}
+		}
+		for(unsigned int c = 0; c + 1 < copies.size(); c++){
+			TerminatorInst *TI = copies[c]->getTerminator();
+			for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+				if(TI->getSuccessor(i) == blocks[first + c + 1])
+					TI->setSuccessor(i, copies[c + 1]);
+			}
+		}
+
+		//edges leaving the path give the phis of their targets the copy's version of what the original passes
+		for(unsigned int c = 0; c < copies.size(); c++){
+			TerminatorInst *TI = copies[c]->getTerminator();
+			for(unsigned int i = 0; i < TI->getNumSuccessors(); i++){
+				BasicBlock *succ = TI->getSuccessor(i);
+				if(c + 1 < copies.size() && succ == copies[c + 1])
+					continue;
+				for(BasicBlock::iterator I = succ->begin(); isa<PHINode>(I); ++I){
+					PHINode *PN = cast<PHINode>(I);
+					Value *in = PN->getIncomingValueForBlock(blocks[first + c]);
+					ValueToValueMapTy::iterator mapped = VMap.find(in);
+					PN->addIncoming(mapped != VMap.end() ? (Value*)mapped->second : in, copies[c]);
+				}
+			}
+		}
+
+		//uses outside a value's own block now see either version
+		vector<pair<Instruction*, BasicBlock*> > defs; //original, block of its copy
+		for(unsigned int c = 0; c < copies.size(); c++){
+			for(auto &I : *blocks[first + c]){
+				defs.push_back(make_pair(&I, copies[c]));
+			}
+		}
+		SSAUpdater SSA;
+		for(unsigned int d = 0; d < defs.size(); d++){
+			Instruction *I = defs[d].first;
+			BasicBlock *BB = I->getParent();
+			vector<Use*> uses;
+			for(Value::use_iterator U = I->use_begin(); U != I->use_end(); ++U){
+				Instruction *user = cast<Instruction>(U->getUser());
+				PHINode *PN = dyn_cast<PHINode>(user);
+				if(PN ? PN->getIncomingBlock(*U) != BB : user->getParent() != BB)
+					uses.push_back(&*U);
+			}
+			if(uses.empty())
+				continue;
+
+			SSA.Initialize(I->getType(), I->getName());
+			SSA.AddAvailableValue(BB, I);
+			SSA.AddAvailableValue(defs[d].second, VMap[I]);
+			for(unsigned int u = 0; u < uses.size(); u++){
+				SSA.RewriteUse(*uses[u]);
+			}
+		}
+		return true;
+	}
+
+	//CS201 Helper Function - counts the chords FunctionContext::computeEdgeProfile picked (or every edge, see -path-profiling-edges)
+	//and adds F's record to the profile. Counts of edges in loops without calls are kept in 'locals' while the loop runs
+	void addEdgeProfile(FunctionContext &ctx, vector<AllocaInst*> &locals){
+		vector<Edge> &cfgEdges = ctx.cfgEdges;
+		unsigned int n = ctx.BBList.size(); //number of the virtual EXIT block
+
+		map<Loop*, vector<pair<AllocaInst*, uint32_t> > > loopCounts; //local count and counter of the edges counted in locals, by loop
+
+		cs201_profile_function function = {hashName(ctx.name), 0, 0, addProfileName(ctx.name), 0, CS201_PROFILE_NONE, 0, n, (uint32_t)profileEdges.size(), (uint32_t)cfgEdges.size() + 1, 0, 0, CS201_PROFILE_NONE, ctx.sampleInterval, 0};
+		profileFunctions.push_back(function);
+
+		for(unsigned int i = 0; i < cfgEdges.size(); i++){
+			Edge &e = cfgEdges[i];
+			cs201_profile_edge rec = {ctx.BBIndex[e.base], e.end ? ctx.BBIndex[e.end] : n, CS201_PROFILE_NONE, CS201_PROFILE_NONE, CS201_PROFILE_NONE, 0};
+			Instruction *insertPt = e.end ? getEdgeInsertPt(e) : e.base->getTerminator();
+			bool reported = (e.end != NULL);
+			bool instrumentable = !e.end || canInstrumentEdge(e.base, e.end);
+
+			if(reported){
+				rec.name = addProfileName(edgeLabel(e));
+				if(EdgeProfiling != EP_CHORDS && instrumentable){
+					uint32_t counter = allocateCounters(1);
+					addEdgeCount(ctx, e, insertPt, counter, loopCounts, locals);
+					if(EdgeProfiling == EP_ALL)
+						rec.counter = counter;
+					else
+						rec.check = counter;
+				}
+			}
+			//a chord without a place for its counter stays unknown, the profile tool prints '?' for what depends on it
+			if(ctx.cfgChord[i] && EdgeProfiling != EP_ALL && instrumentable){
+				rec.counter = allocateCounters(1);
+				addEdgeCount(ctx, e, insertPt, rec.counter, loopCounts, locals);
+			}
+			profileEdges.push_back(rec);
+		}
+
+		//a loop's local counts start at 0 on every edge into it and are added to their counters on every edge out of it
+		for(unsigned int l = 0; l < ctx.loops.size(); l++){
+			Loop *L = ctx.loops[l];
+			auto it = loopCounts.find(L);
+			if(it == loopCounts.end())
+				continue;
+			for(unsigned int i = 0; i < cfgEdges.size(); i++){
+				Edge &e = cfgEdges[i];
+				if(!e.end || L->contains(e.base) == L->contains(e.end))
+					continue;
+
+				IRBuilder<> IRB(getEdgeInsertPt(e));
+				for(unsigned int c = 0; c < it->second.size(); c++){
+					AllocaInst *count = it->second[c].first;
+					if(L->contains(e.end)){
+						IRB.CreateStore(ConstantInt::get(Type::getInt64Ty(*Context), 0), count);
+					}else{
+						addCounterIncrement(IRB, ConstantInt::get(Type::getInt32Ty(*Context), it->second[c].second), IRB.CreateLoad(count));
+					}
+				}
+			}
+		}
+
+		cs201_profile_edge closing = {n, 0, CS201_PROFILE_NONE, CS201_PROFILE_NONE, CS201_PROFILE_NONE, 0};
+		profileEdges.push_back(closing);
+
+		profileFunctions.back().cfgHash = ctx.cfgHash;
+	}
+
+	//CS201 Helper Function - emits 'counters[counter]++' for edge e, or the same on a local if e is inside a loop of
+	//FunctionContext::accumulatorLoops (the outermost such loop around it, so its count is added as rarely as possible)
+	void addEdgeCount(FunctionContext &ctx, Edge &e, Instruction *insertPt, uint32_t counter, map<Loop*, vector<pair<AllocaInst*, uint32_t> > > &loopCounts, vector<AllocaInst*> &locals){
+		IRBuilder<> IRB(insertPt);
+		Loop *L = e.end ? ctx.loopInfo.getLoopFor(e.base) : NULL;
+		while(L && !L->contains(e.end)){
+			L = L->getParentLoop();
+		}
+		if(!L || !ctx.accumulatorLoops.count(L)){
+			addCounterIncrement(IRB, ConstantInt::get(Type::getInt32Ty(*Context), counter));
+			return;
+		}
+		while(L->getParentLoop() && ctx.accumulatorLoops.count(L->getParentLoop())){
+			L = L->getParentLoop();
+		}
+
+		IRBuilder<> EntryIRB(&*ctx.F->getEntryBlock().getFirstInsertionPt());
+		AllocaInst *count = EntryIRB.CreateAlloca(Type::getInt64Ty(*Context), 0, "edgeCount");
+		locals.push_back(count);
+		loopCounts[L].push_back(make_pair(count, counter));
+		IRB.CreateStore(IRB.CreateAdd(IRB.CreateLoad(count), ConstantInt::get(Type::getInt64Ty(*Context), 1)), count);
+	}
+
+	//CS201 Helper Function - reserves 'n' counters in the module's counter array, returns the offset of the first one
+	unsigned int allocateCounters(unsigned int n){
+		unsigned int offset = numCounters;
+		numCounters += n;
+		return offset;
+	}
+
+	//CS201 Helper Function - number of slots in a path table (-path-profiling-table-slots), a power of two of at least one bucket
+	unsigned int pathTableSlots(){
+		return 1u << Log2_32_Ceil(max((unsigned int)PathTableSlots, (unsigned int)CS201_PATH_BUCKET));
+	}
+
+	//CS201 Helper Function - reserves a path table, returns the offset of its first word in 'pathTables'
+	uint32_t allocatePathTable(){
+		uint32_t offset = numPathTableWords;
+		numPathTableWords += 2 * pathTableSlots();
+		return offset;
+	}
+
+	//CS201 Helper Function - emits 'counters[index] += amount' (1 if NULL) for the selected counter mode
+	void addCounterIncrement(IRBuilder<> &IRB, Value *index, Value *amount = NULL){
+		Value *zero = ConstantInt::get(Type::getInt32Ty(*Context), 0);
+		Value *one = amount ? amount : ConstantInt::get(Type::getInt64Ty(*Context), 1);
+
+		if(CounterUpdates == CM_SHARDED){
+			//thread local storage of different threads lives on different pages, so hashing the page of 'shardKey' spreads threads over the shards
+			Value *key = IRB.CreateLShr(IRB.CreatePtrToInt(shardKey, Type::getInt64Ty(*Context)), 12);
+			Value *hash = IRB.CreateMul(IRB.CreateTrunc(key, Type::getInt32Ty(*Context)), ConstantInt::get(Type::getInt32Ty(*Context), 0x9E3779B1));
+			Value *shard = IRB.CreateLShr(hash, 32 - Log2_32(NumCounterShards));
+			index = IRB.CreateAdd(IRB.CreateMul(shard, IRB.CreateLoad(shardStride)), index);
+		}
+
+		Value *indices[] = {zero, index};
+		Value *slot = IRB.CreateGEP(profileCounters, indices);
+		if(CounterUpdates == CM_ATOMIC || CounterUpdates == CM_SHARDED){
+			IRB.CreateAtomicRMW(AtomicRMWInst::Add, slot, one, Monotonic);
+			return;
+		}
+
+		//plain and per-thread counters are never touched by another thread while counting
+		Value *loadAddr = IRB.CreateLoad(slot);
+		Value *addAddr = IRB.CreateAdd(one, loadAddr);
+		if(SaturateCounters){
+			//stay at the maximum instead of wrapping around
+			addAddr = IRB.CreateSelect(IRB.CreateICmpULT(addAddr, loadAddr), ConstantInt::get(Type::getInt64Ty(*Context), UINT64_MAX), addAddr);
+		}
+		IRB.CreateStore(addAddr, slot);
+	}
+
+	//CS201 Helper Function - swaps the size-less placeholder counter array for the real one once every counter is allocated
+	//shared arrays fill whole pages, so the runtime can map them into a shared memory object ($CS201_PROFILE_SHM)
+	GlobalVariable* finalizeCounterArray(Module &M, GlobalVariable *placeholder, unsigned int size){
+		bool shared = placeholder->getThreadLocalMode() == GlobalValue::NotThreadLocal;
+		if(shared){
+			size = (size + CS201_SHM_PAGE / 8 - 1) / (CS201_SHM_PAGE / 8) * (CS201_SHM_PAGE / 8);
+		}
+		ArrayType *counterType = ArrayType::get(Type::getInt64Ty(*Context), size);
+		GlobalVariable *counters = new GlobalVariable(M, counterType, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(counterType), "", NULL, placeholder->getThreadLocalMode());
+		counters->setAlignment(shared ? CS201_SHM_PAGE : CounterLineSize);
+		counters->takeName(placeholder);
+		placeholder->replaceAllUsesWith(ConstantExpr::getBitCast(counters, placeholder->getType()));
+		placeholder->eraseFromParent();
+		return counters;
+	}
+
+	//CS201 Helper Function - lays out the module's counter array now that its size is known
+	void finalizeCounters(Module &M){
+		unsigned int size = numCounters;
+		unsigned int shards = 1;
+		unsigned int stride = numCounters;
+		if(CounterUpdates == CM_SHARDED){
+			//every shard row starts on its own cache line so threads never share one
+			stride = (numCounters + CountersPerLine - 1) / CountersPerLine * CountersPerLine;
+			shardStride->setInitializer(ConstantInt::get(Type::getInt32Ty(*Context), stride));
+			shards = NumCounterShards;
+			size = stride * NumCounterShards;
+		}
+
+		profileCounters = finalizeCounterArray(M, profileCounters, size);
+		pathTables = finalizeCounterArray(M, pathTables, numPathTableWords);
+		if(CounterUpdates == CM_TLS){
+			sharedProfileCounters = finalizeCounterArray(M, sharedProfileCounters, size);
+			addMergeFunc(M);
+			addProfileRegistration(M, sharedProfileCounters, shards, stride);
+		}else{
+			addProfileRegistration(M, profileCounters, shards, stride);
+		}
+	}
+
+	//CS201 Helper Function - fills in 'mergeFunc' and registers it with the runtime, which runs it whenever a thread exits
+	void addMergeFunc(Module &M){
+		Type *i64Ptr = Type::getInt64PtrTy(*Context);
+		Type *mergeArgs[] = {i64Ptr, i64Ptr, Type::getInt32Ty(*Context)};
+		Constant *mergeCounters = M.getOrInsertFunction("__cs201_merge_counters", FunctionType::get(Type::getVoidTy(*Context), mergeArgs, false));
+
+		IRBuilder<> IRB(BasicBlock::Create(*Context, "entry", mergeFunc));
+		Value *zero = ConstantInt::get(Type::getInt32Ty(*Context), 0);
+		Value *indices[] = {zero, zero};
+		Value *local = IRB.CreateInBoundsGEP(profileCounters, indices);
+		Value *shared = IRB.CreateInBoundsGEP(sharedProfileCounters, indices);
+		IRB.CreateCall3(mergeCounters, local, shared, ConstantInt::get(Type::getInt32Ty(*Context), numCounters));
+		IRB.CreateRetVoid();
+
+		Type *registerArgs[] = {mergeFunc->getType()};
+		Constant *registerMerge = M.getOrInsertFunction("__cs201_register_tls_merge", FunctionType::get(Type::getVoidTy(*Context), registerArgs, false));
+		Function *init = Function::Create(FunctionType::get(Type::getVoidTy(*Context), false), GlobalValue::InternalLinkage, "registerThreadCounters", &M);
+		IRBuilder<> InitIRB(BasicBlock::Create(*Context, "entry", init));
+		InitIRB.CreateCall(registerMerge, mergeFunc);
+		InitIRB.CreateRetVoid();
+		appendToGlobalCtors(M, init, 0);
+	}
+
+	//CS201 Helper Function - name of a block in the profile
+	string blockLabel(BasicBlock *BB){
+		//the entry block may still be called plain 'b'
+		if(BB->getName() == "b")
+			return "b0";
+		return BB->getName().str();
+	}
+
+	//CS201 Helper Function - label of an edge in the profile, e.g. "b0 -> b3"
+	string edgeLabel(Edge &e){
+		return blockLabel(e.base) + " -> " + blockLabel(e.end);
+	}
+
+	//CS201 Helper Function - adds a string to the profile's name table, returns its offset
+	uint32_t addProfileName(const string &name){
+		uint32_t offset = profileNames.size();
+		profileNames += name;
+		profileNames.push_back('\0');
+		return offset;
+	}
+
+	//CS201 Helper Function - builds the constant part of the module's profile record (CS201Profile.h)
+	string buildProfileMetadata(){
+		string names = profileNames;
+		//the counts that follow are 8 byte aligned
+		names.resize((names.size() + 7) / 8 * 8, '\0');
+
+		//the names that follow are 8 byte aligned too
+		vector<uint32_t> blockNames = profileBlockNames;
+		if(blockNames.size() % 2 != 0)
+			blockNames.push_back(CS201_PROFILE_NONE);
+
+		cs201_profile_header header = {CS201_PROFILE_MAGIC, CS201_PROFILE_VERSION, (uint32_t)profileFunctions.size(), (uint32_t)profileEdges.size(), numCounters, (uint32_t)names.size(), numPathTableWords,
+			(uint32_t)profileDagEdges.size(), (uint32_t)blockNames.size()};
+		string metadata((const char*)&header, sizeof(header));
+		if(!profileFunctions.empty())
+			metadata.append((const char*)&profileFunctions[0], profileFunctions.size() * sizeof(cs201_profile_function));
+		if(!profileEdges.empty())
+			metadata.append((const char*)&profileEdges[0], profileEdges.size() * sizeof(cs201_profile_edge));
+		if(!profileDagEdges.empty())
+			metadata.append((const char*)&profileDagEdges[0], profileDagEdges.size() * sizeof(cs201_profile_dag_edge));
+		if(!blockNames.empty())
+			metadata.append((const char*)&blockNames[0], blockNames.size() * sizeof(uint32_t));
+		metadata += names;
+		return metadata;
+	}
+
+	//CS201 Helper Function - hands the counters and their layout to the runtime, which writes the profile at exit
+	void addProfileRegistration(Module &M, GlobalVariable *counters, unsigned int shards, unsigned int stride){
+		string metadata = buildProfileMetadata();
+		Constant *metadataConst = ConstantDataArray::getString(*Context, metadata, false);
+		GlobalVariable *profileMetadata = new GlobalVariable(M, metadataConst->getType(), true, GlobalValue::PrivateLinkage, metadataConst, "profileMetadata");
+		profileMetadata->setAlignment(8);
+
+		Type *registerArgs[] = {Type::getInt8PtrTy(*Context), Type::getInt32Ty(*Context), Type::getInt64PtrTy(*Context), Type::getInt32Ty(*Context), Type::getInt32Ty(*Context), Type::getInt64PtrTy(*Context)};
+		Constant *registerProfile = M.getOrInsertFunction("__cs201_register_profile", FunctionType::get(Type::getVoidTy(*Context), registerArgs, false));
+		Function *init = Function::Create(FunctionType::get(Type::getVoidTy(*Context), false), GlobalValue::InternalLinkage, "registerProfile", &M);
+		IRBuilder<> IRB(BasicBlock::Create(*Context, "entry", init));
+		Value *zero = ConstantInt::get(Type::getInt32Ty(*Context), 0);
+		Value *indices[] = {zero, zero};
+		Value *args[] = {IRB.CreateInBoundsGEP(profileMetadata, indices), ConstantInt::get(Type::getInt32Ty(*Context), metadata.size()), IRB.CreateInBoundsGEP(counters, indices), ConstantInt::get(Type::getInt32Ty(*Context), shards), ConstantInt::get(Type::getInt32Ty(*Context), stride), IRB.CreateInBoundsGEP(pathTables, indices)};
+		IRB.CreateCall(registerProfile, args);
+		IRB.CreateRetVoid();
+		appendToGlobalCtors(M, init, 0);
 	}
 
   };
@@ -0,0 +1,130 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- layout of the binary profile written by CS201ProfileRuntime.c
+ *
+ * A profile file is a sequence of module records, one per instrumented module:
+ *
+ *   cs201_profile_header
+ *   cs201_profile_function[numFunctions]
+ *   cs201_profile_edge[numEdges]           CFG of each function, edges of function f at f.firstEdge
+ *   cs201_profile_dag_edge[numDagEdges]    path numbering DAG of each path profiled function, at f.firstDagEdge
+ *   uint32_t blockNames[numBlockNames]     name table offset of each block, a function's at f.blockNames (even count, padded with NONE)
+ *   char names[namesSize]                  NUL terminated strings, padded to 8 bytes
+ *   uint64_t counts[numCounters]
+ *   uint64_t pathTables[pathTableSize]     path tables of the functions with too many paths for a counter each
+ *
+ * Edge profiling only counts some edges of a function (see -path-profiling-edges). The CFG also has a
+ * virtual EXIT block (number numBlocks) that every returning block flows into and that flows back into
+ * the entry block, so the missing counts follow from flow conservation at every block.
+ *
+ * A function with few paths has a counter per path (counts[counterBase + path]). One with many has a path table
+ * instead: an open addressing hash table of (path + 1, count) slot pairs, CS201_PATH_BUCKET slots to a cache line.
+ * A key of 0 is a free slot; the last slot of a table counts the paths that found it full.
+ *
+ * Path p of a function is decoded by walking its DAG from the entry block (block 0): at every block take the outgoing edge with
+ * the largest value not above what is left of p, and subtract the value. The walk ends at EXIT, a vertex after the blocks
+ * (number numBlocks) that only dummy edges go to.
+ * A path starting with an ENTRY dummy begins right after a back edge (or a loop region boundary), one ending with an EXIT
+ * dummy ends right before one.
+ *
+ * Everything up to the counts is emitted as a constant by the pass, the runtime only appends the counts.
+ * Fields are in the byte order of the profiled machine.
+ *
+ * With $CS201_PROFILE_SHM set, the runtime also keeps the counters of a running program in that POSIX shared memory
+ * object (the counter arrays' own pages are mapped onto it, so counting is unchanged). It outlives the program:
+ *
+ *   cs201_shm_header                       padded to CS201_SHM_PAGE, like everything after it
+ *   per module: cs201_shm_module, then the module record up to the counts (metadataSize bytes)
+ *               uint64_t counters[numShards * shardStride] at 'counters', counter i of shard s at s * shardStride + i
+ *               uint64_t pathTables[pathTableSize] at 'pathTables'
+ */
+
+#ifndef CS201_PROFILE_H
+#define CS201_PROFILE_H
+
+#include <stdint.h>
+
+#define CS201_PROFILE_MAGIC 0x4652503130325343ULL /* "CS201PRF" */
+#define CS201_PROFILE_VERSION 7
+#define CS201_PROFILE_NONE 0xffffffffu /* no counter / no name / no path table */
+#define CS201_PATH_BUCKET 4 /* path table slots in a cache line */
+
+struct cs201_profile_header{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t numFunctions;
+	uint32_t numEdges;
+	uint32_t numCounters;
+	uint32_t namesSize;
+	uint32_t pathTableSize; /* uint64_t words */
+	uint32_t numDagEdges;
+	uint32_t numBlockNames;
+};
+
+struct cs201_profile_function{
+	uint64_t hash; /* FNV-1a of the function name */
+	uint64_t cfgHash; /* FNV-1a of its block count and CFG edges, stable as long as the function's code is */
+	uint64_t numPaths; /* 0 if the function was not path profiled */
+	uint32_t name; /* offset in the name table */
+	uint32_t counterBase; /* path counters, if it has no path table */
+	uint32_t pathTable; /* first word of its path table in pathTables, or NONE */
+	uint32_t pathTableSlots; /* a power of two */
+	uint32_t numBlocks;
+	uint32_t firstEdge;
+	uint32_t numEdges;
+	uint32_t firstDagEdge;
+	uint32_t numDagEdges; /* 0 if the function was not path profiled */
+	uint32_t blockNames; /* first of its block names in blockNames, or NONE */
+	uint32_t sampleInterval; /* its counts cover one call in this many (-path-profiling-sample), 1 for every call */
+	uint32_t reserved;
+};
+
+struct cs201_profile_edge{
+	uint32_t src; /* block numbers, numBlocks is the virtual EXIT block */
+	uint32_t dst;
+	uint32_t counter; /* counter of the edge, NONE if it is recovered from the others */
+	uint32_t check; /* independent counter of the edge for validation, or NONE */
+	uint32_t name; /* label printed for the edge, NONE for edges that are not reported */
+	uint32_t reserved;
+};
+
+#define CS201_SHM_MAGIC 0x4d48533130325343ULL /* "CS201SHM" */
+#define CS201_SHM_PAGE 4096 /* alignment and size granularity of the counter arrays, the largest page size live counters work with */
+
+struct cs201_shm_header{
+	uint64_t magic;
+	uint32_t version; /* CS201_PROFILE_VERSION */
+	uint32_t numModules; /* modules registered so far */
+};
+
+struct cs201_shm_module{
+	uint64_t counters; /* offsets in the object */
+	uint64_t pathTables;
+	uint64_t end; /* offset of the next module */
+	uint32_t metadataSize;
+	uint32_t numShards;
+	uint32_t shardStride;
+	uint32_t reserved;
+};
+
+/* first bucket of path table probing for a key (path + 1), numSlots / CS201_PATH_BUCKET buckets in all */
+static inline uint32_t cs201_path_bucket(uint64_t key, uint32_t numSlots){
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (numSlots / CS201_PATH_BUCKET - 1);
+}
+
+/* kinds of path numbering DAG edges */
+#define CS201_DAG_REAL 0 /* a CFG edge */
+#define CS201_DAG_ENTRY 1 /* entry block -> target of back edges (paths starting after one) */
+#define CS201_DAG_EXIT 2 /* source of a back edge -> EXIT (paths ending before it) */
+#define CS201_DAG_LEAF 3 /* returning or unreachable block -> EXIT */
+
+struct cs201_profile_dag_edge{
+	uint32_t src; /* block numbers, dst is numBlocks for EXIT */
+	uint32_t dst;
+	int64_t value; /* Ball-Larus edge value */
+	uint32_t kind; /* CS201_DAG_* */
+	uint32_t reserved;
+};
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- adds up binary profiles (CS201ProfileRuntime.c) of many runs of the same program. Profiles whose functions or
+ * CFGs do not match the first one (see cs201_profile_function::cfgHash) are rejected (exit status 2). Counters are
+ * summed in parallel, in chunks of plain arrays the compiler vectorizes; they stop at their maximum instead of wrapping:
+ *
+ *   c++ -O2 -pthread CS201ProfileMerge.cpp -o cs201-merge
+ *   cs201-merge [-j threads] -o merged.prof run1.prof run2.prof ...
+ */
+
+#include "CS201ProfileReader.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const size_t MergeChunk = 1 << 14; //counters summed by a thread at a time
+
+// CS201 --- one profile file, split into its module records
+struct InputProfile{
+	const char *path;
+	vector<char> data;
+	vector<CS201ProfileModule> modules;
+	vector<string> metadata; //each record up to its counts
+	string error; //why the file was not read, or was rejected
+};
+
+//CS201 Helper Function - reads and splits one profile, false (with 'error' set) if it is unreadable or malformed
+static bool readInput(InputProfile &in){
+	if(!readProfileFile(in.path, in.data)){
+		in.error = "can not read";
+		return false;
+	}
+	size_t pos = 0;
+	while(pos < in.data.size()){
+		CS201ProfileModule m;
+		size_t end = readProfileModule(in.data, pos, m, in.error);
+		if(end == 0)
+			return false;
+		size_t countsSize = (m.count.size() + m.pathTables.size()) * sizeof(uint64_t);
+		in.metadata.push_back(string(&in.data[pos], end - pos - countsSize));
+		in.modules.push_back(m);
+		pos = end;
+	}
+	//the counts are in 'modules' now
+	vector<char>().swap(in.data);
+	return true;
+}
+
+//CS201 Helper Function - false (with 'error' set) if 'in' was not written by the same instrumented program as 'ref'
+static bool matches(const InputProfile &ref, InputProfile &in){
+	if(in.modules.size() != ref.modules.size()){
+		in.error = "has " + to_string(in.modules.size()) + " modules instead of " + to_string(ref.modules.size());
+		return false;
+	}
+	for(size_t i = 0; i < ref.modules.size(); i++){
+		if(in.metadata[i] == ref.metadata[i])
+			continue;
+
+		//say which function differs if one does
+		const CS201ProfileModule &a = ref.modules[i], &b = in.modules[i];
+		for(size_t f = 0; f < a.functions.size() && f < b.functions.size(); f++){
+			if(a.functions[f].hash != b.functions[f].hash){
+				in.error = "has function " + b.nameAt(b.functions[f].name) + " where " + a.nameAt(a.functions[f].name) + " was expected";
+				return false;
+			}
+			if(a.functions[f].cfgHash != b.functions[f].cfgHash){
+				in.error = "has a different CFG for " + a.nameAt(a.functions[f].name);
+				return false;
+			}
+		}
+		in.error = "was instrumented differently (module " + to_string(i) + ")";
+		return false;
+	}
+	return true;
+}
+
+//CS201 Helper Function - dst[i] += src[i], staying at the maximum instead of wrapping (a branch free loop the compiler vectorizes)
+static void addCounts(uint64_t *__restrict dst, const uint64_t *__restrict src, size_t n){
+	for(size_t i = 0; i < n; i++){
+		uint64_t sum = dst[i] + src[i];
+		dst[i] = (sum < dst[i]) ? UINT64_MAX : sum;
+	}
+}
+
+//CS201 Helper Function - adds 'count' to path 'key' (path + 1) of a path table, probing like __cs201_count_path does
+static void addPath(uint64_t *table, uint32_t numSlots, uint64_t key, uint64_t count){
+	uint32_t bucket = cs201_path_bucket(key, numSlots);
+	uint32_t mask = numSlots / CS201_PATH_BUCKET - 1;
+	uint64_t *lost = &table[2 * (numSlots - 1)];
+	for(uint32_t probe = 0; probe <= mask; probe++){
+		uint64_t *line = &table[2 * CS201_PATH_BUCKET * ((bucket + probe) & mask)];
+		for(uint32_t i = 0; i < CS201_PATH_BUCKET; i++){
+			uint64_t *slot = &line[2 * i];
+			if(slot == lost)
+				break;
+			if(slot[0] == 0)
+				slot[0] = key;
+			if(slot[0] == key){
+				addCounts(&slot[1], &count, 1);
+				return;
+			}
+		}
+	}
+	addCounts(&lost[1], &count, 1);
+}
+
+int main(int argc, char **argv){
+	unsigned int numThreads = thread::hardware_concurrency();
+	const char *output = NULL;
+	vector<InputProfile> inputs;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		if(arg == "-o" && i + 1 < argc){
+			output = argv[++i];
+		}else if(arg == "-j" && i + 1 < argc){
+			numThreads = strtoul(argv[++i], NULL, 10);
+		}else{
+			InputProfile in;
+			in.path = argv[i];
+			inputs.push_back(in);
+		}
+	}
+	if(output == NULL || inputs.empty()){
+		cerr << "usage: cs201-merge [-j threads] -o merged.prof run1.prof run2.prof ...\n";
+		return 1;
+	}
+	numThreads = max(1u, numThreads);
+
+	//files are read in parallel too, each thread takes the next one not yet taken
+	atomic<size_t> next(0);
+	vector<char> readable(inputs.size(), 0);
+	auto reader = [&](){
+		for(size_t i = next++; i < inputs.size(); i = next++){
+			readable[i] = readInput(inputs[i]);
+		}
+	};
+	vector<thread> workers;
+	for(unsigned int t = 1; t < min(numThreads, (unsigned int)inputs.size()); t++){
+		workers.push_back(thread(reader));
+	}
+	reader();
+	for(size_t t = 0; t < workers.size(); t++){
+		workers[t].join();
+	}
+	workers.clear();
+
+	//the first readable profile decides what the others have to look like
+	vector<InputProfile*> accepted;
+	bool rejected = false;
+	for(size_t i = 0; i < inputs.size(); i++){
+		if(readable[i] && (accepted.empty() || matches(*accepted[0], inputs[i]))){
+			accepted.push_back(&inputs[i]);
+		}else{
+			cerr << "cs201-merge: " << inputs[i].path << ": " << inputs[i].error << ", skipped\n";
+			rejected = true;
+		}
+	}
+	if(accepted.empty())
+		return 1;
+
+	//counters: the chunks of every module go to the threads, each chunk is summed over all profiles while it is in cache
+	InputProfile &merged = *accepted[0];
+	vector<pair<size_t, size_t> > chunks; //module, first counter
+	for(size_t m = 0; m < merged.modules.size(); m++){
+		for(size_t c = 0; c < merged.modules[m].count.size(); c += MergeChunk){
+			chunks.push_back(make_pair(m, c));
+		}
+	}
+	next = 0;
+	auto adder = [&](){
+		for(size_t i = next++; i < chunks.size(); i = next++){
+			vector<uint64_t> &dst = merged.modules[chunks[i].first].count;
+			size_t n = min(MergeChunk, dst.size() - chunks[i].second);
+			for(size_t p = 1; p < accepted.size(); p++){
+				addCounts(&dst[chunks[i].second], &accepted[p]->modules[chunks[i].first].count[chunks[i].second], n);
+			}
+		}
+	};
+	for(unsigned int t = 1; t < min(numThreads, (unsigned int)chunks.size()); t++){
+		workers.push_back(thread(adder));
+	}
+	adder();
+	for(size_t t = 0; t < workers.size(); t++){
+		workers[t].join();
+	}
+
+	//path tables hold different paths in different runs, their entries are added one by one
+	for(size_t m = 0; m < merged.modules.size(); m++){
+		CS201ProfileModule &dst = merged.modules[m];
+		for(size_t f = 0; f < dst.functions.size(); f++){
+			const cs201_profile_function &function = dst.functions[f];
+			if(function.pathTable == CS201_PROFILE_NONE)
+				continue;
+			uint64_t *table = &dst.pathTables[function.pathTable];
+			for(size_t p = 1; p < accepted.size(); p++){
+				const uint64_t *src = &accepted[p]->modules[m].pathTables[function.pathTable];
+				for(uint32_t slot = 0; slot + 1 < function.pathTableSlots; slot++){
+					if(src[2 * slot] != 0)
+						addPath(table, function.pathTableSlots, src[2 * slot], src[2 * slot + 1]);
+				}
+				addCounts(&table[2 * (function.pathTableSlots - 1) + 1], &src[2 * (function.pathTableSlots - 1) + 1], 1);
+			}
+		}
+	}
+
+	ofstream out(output, ios::binary);
+	for(size_t m = 0; m < merged.modules.size(); m++){
+		const CS201ProfileModule &module = merged.modules[m];
+		out.write(merged.metadata[m].data(), merged.metadata[m].size());
+		out.write((const char *)module.count.data(), module.count.size() * sizeof(uint64_t));
+		out.write((const char *)module.pathTables.data(), module.pathTables.size() * sizeof(uint64_t));
+	}
+	out.close();
+	if(!out){
+		cerr << "cs201-merge: can not write " << output << "\n";
+		return 1;
+	}
+	cerr << "cs201-merge: merged " << accepted.size() << " of " << inputs.size() << " profiles into " << output << "\n";
+	return rejected ? 2 : 0;
+}
@@ -0,0 +1,350 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- reading binary profiles (CS201Profile.h) and live counters, recovering edge counts and decoding paths. Shared by
+ * the tools (cs201-profile, cs201-paths, cs201-merge) and the pass (-path-profiling-weights, -path-profiling-use and its
+ * superblocks)
+ */
+
+#ifndef CS201_PROFILE_READER_H
+#define CS201_PROFILE_READER_H
+
+#include "CS201Profile.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+// CS201 --- one module record of a profile
+struct CS201ProfileModule{
+	cs201_profile_header header;
+	std::vector<cs201_profile_function> functions;
+	std::vector<cs201_profile_edge> edges;
+	std::vector<cs201_profile_dag_edge> dagEdges;
+	std::vector<uint32_t> blockNames;
+	std::vector<char> names;
+	std::vector<uint64_t> count;
+	std::vector<uint64_t> pathTables;
+
+	//name table string at 'offset', empty if it is out of bounds
+	std::string nameAt(uint32_t offset) const{
+		if(offset >= names.size())
+			return "";
+		const char *begin = &names[offset];
+		return std::string(begin, strnlen(begin, names.size() - offset));
+	}
+};
+
+//CS201 Helper Function - reads a whole file, false if it can not be opened
+inline bool readProfileFile(const char *path, std::vector<char> &data){
+	std::ifstream in(path, std::ios::binary);
+	if(!in)
+		return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+//CS201 Helper Function - snapshot of the live counters of a running program ($CS201_PROFILE_SHM, CS201Profile.h) in the
+//layout of a profile file. Every counter is read atomically, but the program keeps counting while they are read
+inline bool readShmProfile(const char *name, std::vector<char> &data, std::string &error){
+	int fd = shm_open(name, O_RDONLY, 0);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cs201_shm_header)){
+		error = std::string("can not open shared memory object ") + name;
+		if(fd >= 0)
+			close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		error = std::string("can not map shared memory object ") + name;
+		return false;
+	}
+
+	const char *base = (const char *)map;
+	const cs201_shm_header *header = (const cs201_shm_header *)base;
+	bool valid = header->magic == CS201_SHM_MAGIC && header->version == CS201_PROFILE_VERSION;
+	uint64_t pos = (sizeof(cs201_shm_header) + CS201_SHM_PAGE - 1) / CS201_SHM_PAGE * CS201_SHM_PAGE;
+	data.clear();
+	for(uint32_t i = 0; valid && i < __atomic_load_n(&header->numModules, __ATOMIC_ACQUIRE); i++){
+		if(pos + sizeof(cs201_shm_module) > size){
+			valid = false;
+			break;
+		}
+		const cs201_shm_module *module = (const cs201_shm_module *)(base + pos);
+		const cs201_profile_header *record = (const cs201_profile_header *)(module + 1);
+		uint64_t counterWords = (uint64_t)module->numShards * module->shardStride;
+		if(module->metadataSize < sizeof(cs201_profile_header) || pos + sizeof(cs201_shm_module) + module->metadataSize > size
+			|| module->counters + counterWords * sizeof(uint64_t) > size || module->pathTables + (uint64_t)record->pathTableSize * sizeof(uint64_t) > size
+			|| module->end > size || module->end <= pos || (uint64_t)record->numCounters > module->shardStride){
+			valid = false;
+			break;
+		}
+
+		data.insert(data.end(), (const char *)record, (const char *)record + module->metadataSize);
+		const uint64_t *counters = (const uint64_t *)(base + module->counters);
+		for(uint32_t c = 0; c < record->numCounters; c++){
+			uint64_t sum = 0;
+			for(uint32_t s = 0; s < module->numShards; s++){
+				sum += __atomic_load_n(&counters[(uint64_t)s * module->shardStride + c], __ATOMIC_RELAXED);
+			}
+			data.insert(data.end(), (const char *)&sum, (const char *)&sum + sizeof(sum));
+		}
+		const uint64_t *tables = (const uint64_t *)(base + module->pathTables);
+		for(uint32_t w = 0; w < record->pathTableSize; w++){
+			uint64_t word = __atomic_load_n(&tables[w], __ATOMIC_RELAXED);
+			data.insert(data.end(), (const char *)&word, (const char *)&word + sizeof(word));
+		}
+		pos = module->end;
+	}
+	munmap(map, size);
+	if(!valid)
+		error = std::string("malformed shared memory object ") + name;
+	return valid;
+}
+
+//CS201 Helper Function - copies 'n' T out of the profile, false if it would read past its end
+template<typename T>
+inline bool readProfileArray(const std::vector<char> &data, size_t pos, size_t n, std::vector<T> &values){
+	if(pos > data.size() || (data.size() - pos) / sizeof(T) < n)
+		return false;
+	values.resize(n);
+	if(n != 0)
+		memcpy(&values[0], &data[pos], n * sizeof(T));
+	return true;
+}
+
+//CS201 Helper Function - reads the module record at 'pos' and checks that everything in it is in range
+//returns the position of the next record, 0 on a malformed record ('error' says why)
+inline size_t readProfileModule(const std::vector<char> &data, size_t pos, CS201ProfileModule &m, std::string &error){
+	std::vector<cs201_profile_header> header;
+	if(!readProfileArray(data, pos, 1, header) || header[0].magic != CS201_PROFILE_MAGIC){
+		error = "not a CS201 profile";
+		return 0;
+	}
+	m.header = header[0];
+	if(m.header.version != CS201_PROFILE_VERSION){
+		error = "unsupported profile version " + std::to_string(m.header.version);
+		return 0;
+	}
+
+	pos += sizeof(cs201_profile_header);
+	if(!readProfileArray(data, pos, m.header.numFunctions, m.functions)
+		|| !readProfileArray(data, pos += m.functions.size() * sizeof(cs201_profile_function), m.header.numEdges, m.edges)
+		|| !readProfileArray(data, pos += m.edges.size() * sizeof(cs201_profile_edge), m.header.numDagEdges, m.dagEdges)
+		|| !readProfileArray(data, pos += m.dagEdges.size() * sizeof(cs201_profile_dag_edge), m.header.numBlockNames, m.blockNames)
+		|| !readProfileArray(data, pos += m.blockNames.size() * sizeof(uint32_t), m.header.namesSize, m.names)
+		|| !readProfileArray(data, pos += m.names.size(), m.header.numCounters, m.count)
+		|| !readProfileArray(data, pos += m.count.size() * sizeof(uint64_t), m.header.pathTableSize, m.pathTables)){
+		error = "truncated profile";
+		return 0;
+	}
+	pos += m.pathTables.size() * sizeof(uint64_t);
+
+	for(uint32_t f = 0; f < m.functions.size(); f++){
+		const cs201_profile_function &function = m.functions[f];
+		bool inRange = (uint64_t)function.firstEdge + function.numEdges <= m.edges.size();
+		if(function.pathTable != CS201_PROFILE_NONE){
+			inRange = inRange && function.pathTableSlots != 0 && (uint64_t)function.pathTable + 2 * (uint64_t)function.pathTableSlots <= m.pathTables.size();
+		}else{
+			inRange = inRange && (uint64_t)function.counterBase + function.numPaths <= m.count.size();
+		}
+		for(uint32_t e = 0; inRange && e < function.numEdges; e++){
+			const cs201_profile_edge &edge = m.edges[function.firstEdge + e];
+			inRange = edge.src <= function.numBlocks && edge.dst <= function.numBlocks
+				&& (edge.counter == CS201_PROFILE_NONE || edge.counter < m.count.size())
+				&& (edge.check == CS201_PROFILE_NONE || edge.check < m.count.size());
+		}
+		if(function.numDagEdges != 0){
+			inRange = inRange && (uint64_t)function.firstDagEdge + function.numDagEdges <= m.dagEdges.size()
+				&& function.blockNames != CS201_PROFILE_NONE && (uint64_t)function.blockNames + function.numBlocks <= m.blockNames.size();
+		}
+		for(uint32_t e = 0; inRange && e < function.numDagEdges; e++){
+			const cs201_profile_dag_edge &edge = m.dagEdges[function.firstDagEdge + e];
+			inRange = edge.src < function.numBlocks && edge.dst <= function.numBlocks && edge.value >= 0;
+		}
+		if(!inRange){
+			error = "function record out of range";
+			return 0;
+		}
+	}
+	return pos;
+}
+
+//CS201 Helper Function - counts of a function's edges: counted edges are read from 'count', the others are recovered
+//from flow conservation by repeatedly solving a block with a single unknown edge (the unknown edges form a spanning tree)
+inline void recoverEdgeCounts(const cs201_profile_function &function, const cs201_profile_edge *edges, const std::vector<uint64_t> &count, std::vector<int64_t> &value, std::vector<bool> &known){
+	unsigned int numVertices = function.numBlocks + 1;
+	std::vector<std::vector<uint32_t> > incident(numVertices);
+	std::vector<int64_t> balance(numVertices, 0); //known inflow - known outflow
+	std::vector<unsigned> unknown(numVertices, 0);
+
+	value.assign(function.numEdges, 0);
+	known.assign(function.numEdges, false);
+	for(uint32_t e = 0; e < function.numEdges; e++){
+		const cs201_profile_edge &edge = edges[e];
+		if(edge.counter != CS201_PROFILE_NONE){
+			value[e] = count[edge.counter];
+			known[e] = true;
+			balance[edge.dst] += value[e];
+			balance[edge.src] -= value[e];
+		}else if(edge.src != edge.dst){
+			//a self loop never changes the balance of its block, it can only be counted
+			incident[edge.src].push_back(e);
+			incident[edge.dst].push_back(e);
+			unknown[edge.src]++;
+			unknown[edge.dst]++;
+		}
+	}
+
+	std::vector<unsigned> worklist;
+	for(unsigned int v = 0; v < numVertices; v++){
+		if(unknown[v] == 1)
+			worklist.push_back(v);
+	}
+	while(!worklist.empty()){
+		unsigned v = worklist.back();
+		worklist.pop_back();
+		if(unknown[v] != 1)
+			continue;
+
+		for(unsigned int i = 0; i < incident[v].size(); i++){
+			uint32_t e = incident[v][i];
+			if(known[e])
+				continue;
+
+			const cs201_profile_edge &edge = edges[e];
+			value[e] = (edge.dst == v) ? -balance[v] : balance[v];
+			known[e] = true;
+			balance[edge.dst] += value[e];
+			balance[edge.src] -= value[e];
+			unknown[edge.src]--;
+			unknown[edge.dst]--;
+
+			unsigned other = (edge.dst == v) ? edge.src : edge.dst;
+			if(unknown[other] == 1)
+				worklist.push_back(other);
+			break;
+		}
+	}
+}
+
+// CS201 --- a function's path numbering DAG with the outgoing edges of every block sorted by value, so decoding a path is a
+// binary search per block
+struct CS201PathDecoder{
+	const cs201_profile_function &function;
+	std::vector<uint32_t> outStart; //outgoing edges of block v are out[outStart[v] .. outStart[v+1])
+	std::vector<const cs201_profile_dag_edge*> out;
+
+	CS201PathDecoder(const CS201ProfileModule &m, const cs201_profile_function &function) : function(function) {
+		const cs201_profile_dag_edge *edges = m.dagEdges.data() + function.firstDagEdge;
+		outStart.assign(function.numBlocks + 1, 0);
+		for(uint32_t e = 0; e < function.numDagEdges; e++){
+			outStart[edges[e].src + 1]++;
+		}
+		for(uint32_t v = 0; v < function.numBlocks; v++){
+			outStart[v+1] += outStart[v];
+		}
+
+		out.resize(function.numDagEdges);
+		std::vector<uint32_t> next(outStart.begin(), outStart.end() - 1);
+		for(uint32_t e = 0; e < function.numDagEdges; e++){
+			out[next[edges[e].src]++] = &edges[e];
+		}
+		for(uint32_t v = 0; v < function.numBlocks; v++){
+			std::stable_sort(out.begin() + outStart[v], out.begin() + outStart[v+1],
+				[](const cs201_profile_dag_edge *a, const cs201_profile_dag_edge *b){ return a->value < b->value; });
+		}
+	}
+
+	//CS201 Helper Function - the blocks of path p, false if it is not a path of the function. 'afterCut' and 'beforeCut' say
+	//whether it starts right after or ends right before a back edge (or a loop region boundary)
+	bool decode(uint64_t p, std::vector<uint32_t> &blocks, bool &afterCut, bool &beforeCut) const{
+		blocks.clear();
+		afterCut = beforeCut = false;
+		if(p >= function.numPaths)
+			return false;
+
+		uint64_t left = p;
+		uint32_t v = 0;
+		//every step leaves a block of the DAG, which has no cycles, so the walk ends
+		for(uint32_t steps = 0; steps <= function.numBlocks; steps++){
+			//only dummies, which end the walk, go to EXIT
+			if(v >= function.numBlocks)
+				return false;
+			uint32_t begin = outStart[v], end = outStart[v+1];
+			if(begin == end){
+				if(blocks.empty())
+					blocks.push_back(v);
+				return true;
+			}
+
+			//the last edge whose value is not above what is left of the path
+			uint32_t lo = begin, hi = end;
+			while(hi - lo > 1){
+				uint32_t mid = (lo + hi) / 2;
+				if((uint64_t)out[mid]->value <= left)
+					lo = mid;
+				else
+					hi = mid;
+			}
+			const cs201_profile_dag_edge &e = *out[lo];
+			left -= e.value;
+
+			//only the first edge can be an ENTRY dummy
+			if(blocks.empty()){
+				afterCut = (e.kind == CS201_DAG_ENTRY);
+				if(!afterCut)
+					blocks.push_back(e.src);
+			}
+			if(e.kind == CS201_DAG_ENTRY || e.kind == CS201_DAG_REAL)
+				blocks.push_back(e.dst);
+			v = e.dst;
+
+			//dummies into the exit block end the path there
+			if(e.kind == CS201_DAG_EXIT || e.kind == CS201_DAG_LEAF){
+				beforeCut = (e.kind == CS201_DAG_EXIT);
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+//CS201 Helper Function - (path, count) of every path of a function that was taken, 'lost' counts the ones a full path table dropped
+inline void takenPaths(const CS201ProfileModule &m, const cs201_profile_function &function, std::vector<std::pair<uint64_t, uint64_t> > &taken, uint64_t &lost){
+	lost = 0;
+	if(function.pathTable == CS201_PROFILE_NONE){
+		for(uint64_t p = 0; p < function.numPaths; p++){
+			if(m.count[function.counterBase + p] != 0)
+				taken.push_back(std::make_pair(p, m.count[function.counterBase + p]));
+		}
+		return;
+	}
+
+	const uint64_t *table = m.pathTables.data() + function.pathTable;
+	for(uint32_t slot = 0; slot + 1 < function.pathTableSlots; slot++){
+		if(table[2 * slot] != 0)
+			taken.push_back(std::make_pair(table[2 * slot] - 1, table[2 * slot + 1]));
+	}
+	lost = table[2 * (function.pathTableSlots - 1) + 1];
+}
+
+//CS201 Helper Function - orders the 'k' hottest paths first (ties by path id)
+inline void sortHottest(std::vector<std::pair<uint64_t, uint64_t> > &taken, size_t k){
+	k = std::min(k, taken.size());
+	std::partial_sort(taken.begin(), taken.begin() + k, taken.end(), [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b){
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+}
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- runtime support for programs instrumented by CS201PathProfiling
+ *
+ * Writes the counters of every instrumented module to a binary profile (CS201Profile.h) when the
+ * program exits, in $CS201_PROFILE_FILE or cs201.prof. CS201ProfileTool prints it as text.
+ * For -path-profiling-counters=tls every thread counts into its own copy of the counters and adds
+ * them to the shared copy when it exits. With $CS201_PROFILE_SHM set (a shared memory object name such as
+ * /cs201) the counters can also be read while the program runs (cs201-profile --shm /cs201). Link it into the
+ * profiled program:
+ *
+ *   clang prog.bc CS201ProfileRuntime.c -o prog -lpthread -ldl -lrt
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "CS201Profile.h"
+
+#define CS201_MAX_MODULES 64
+
+typedef void (*cs201_merge_fn)(void);
+
+/* one merge function per instrumented module, registered from global constructors (single threaded) */
+static cs201_merge_fn merges[CS201_MAX_MODULES];
+static int numMerges = 0;
+
+/* adds a thread's counters to the shared ones, then clears them so merging twice is harmless */
+void __cs201_merge_counters(uint64_t *local, uint64_t *shared, uint32_t n){
+	uint32_t i;
+	for(i = 0; i < n; i++){
+		if(local[i] != 0){
+			__atomic_fetch_add(&shared[i], local[i], __ATOMIC_RELAXED);
+			local[i] = 0;
+		}
+	}
+}
+
+static void runMerges(void){
+	int i;
+	for(i = 0; i < numMerges; i++){
+		merges[i]();
+	}
+}
+
+void __cs201_register_tls_merge(cs201_merge_fn merge){
+	/* the main thread never goes through pthread_exit, merge its counters at exit */
+	if(numMerges == 0){
+		atexit(runMerges);
+	}
+	if(numMerges < CS201_MAX_MODULES){
+		merges[numMerges++] = merge;
+	}
+}
+
+/* counts a path of a function with a path table (CS201Profile.h): linear probing over cache line buckets starting at the
+ * path's hash, a free slot is claimed with a compare-and-swap, so no lock is ever taken */
+void __cs201_count_path(uint64_t *table, uint32_t numSlots, uint64_t path){
+	uint64_t key = path + 1;
+	uint32_t mask = numSlots / CS201_PATH_BUCKET - 1;
+	uint32_t bucket = cs201_path_bucket(key, numSlots);
+	uint64_t *lost = &table[2 * (numSlots - 1)];
+	uint32_t probe, i;
+
+	for(probe = 0; probe <= mask; probe++){
+		uint64_t *line = &table[2 * CS201_PATH_BUCKET * ((bucket + probe) & mask)];
+		for(i = 0; i < CS201_PATH_BUCKET; i++){
+			uint64_t *slot = &line[2 * i];
+			uint64_t k;
+
+			if(slot == lost){
+				break;
+			}
+			k = __atomic_load_n(&slot[0], __ATOMIC_RELAXED);
+			if(k == 0){
+				/* on failure 'k' is the key another thread put there first */
+				if(__atomic_compare_exchange_n(&slot[0], &k, key, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+					k = key;
+				}
+			}
+			if(k == key){
+				__atomic_fetch_add(&slot[1], 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+	__atomic_fetch_add(&lost[1], 1, __ATOMIC_RELAXED);
+}
+
+/* counters and layout of one instrumented module, registered from its global constructor */
+struct cs201_profile_module{
+	const uint8_t *metadata; /* everything of the module record up to the counts */
+	uint32_t metadataSize;
+	const uint64_t *counters;
+	uint32_t numShards; /* sharded counters: counter i of shard s is counters[s * shardStride + i] */
+	uint32_t shardStride;
+	const uint64_t *pathTables; /* shared by all threads */
+};
+
+static struct cs201_profile_module profiles[CS201_MAX_MODULES];
+static int numProfiles = 0;
+
+static void dumpProfiles(void){
+	static int dumped = 0;
+	const char *path;
+	size_t size = 0, pos = 0;
+	uint8_t *buf;
+	int i, fd;
+
+	if(dumped){
+		return;
+	}
+	dumped = 1;
+
+	/* the exiting thread has not merged its counters yet */
+	runMerges();
+
+	for(i = 0; i < numProfiles; i++){
+		const struct cs201_profile_header *header = (const struct cs201_profile_header *)profiles[i].metadata;
+		size += profiles[i].metadataSize + ((size_t)header->numCounters + header->pathTableSize) * sizeof(uint64_t);
+	}
+	buf = malloc(size);
+	if(buf == NULL){
+		return;
+	}
+
+	for(i = 0; i < numProfiles; i++){
+		const struct cs201_profile_module *m = &profiles[i];
+		const struct cs201_profile_header *header = (const struct cs201_profile_header *)m->metadata;
+		uint64_t *counts, *tables;
+		uint32_t c, s;
+
+		memcpy(buf + pos, m->metadata, m->metadataSize);
+		pos += m->metadataSize;
+		counts = (uint64_t *)(buf + pos);
+		for(c = 0; c < header->numCounters; c++){
+			uint64_t sum = 0;
+			for(s = 0; s < m->numShards; s++){
+				sum += __atomic_load_n(&m->counters[s * m->shardStride + c], __ATOMIC_RELAXED);
+			}
+			counts[c] = sum;
+		}
+		pos += (size_t)header->numCounters * sizeof(uint64_t);
+
+		tables = (uint64_t *)(buf + pos);
+		for(c = 0; c < header->pathTableSize; c++){
+			tables[c] = __atomic_load_n(&m->pathTables[c], __ATOMIC_RELAXED);
+		}
+		pos += (size_t)header->pathTableSize * sizeof(uint64_t);
+	}
+
+	path = getenv("CS201_PROFILE_FILE");
+	if(path == NULL || path[0] == '\0'){
+		path = "cs201.prof";
+	}
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0){
+		if(write(fd, buf, size) != (ssize_t)size){
+			unlink(path);
+		}
+		close(fd);
+	}
+	free(buf);
+}
+
+/* live counters ($CS201_PROFILE_SHM), laid out in CS201Profile.h */
+static int shmFd = -1;
+static int shmFailed = 0;
+static uint64_t shmSize = 0;
+static struct cs201_shm_header shmHeader;
+
+static uint64_t pageRound(uint64_t size){
+	return (size + CS201_SHM_PAGE - 1) / CS201_SHM_PAGE * CS201_SHM_PAGE;
+}
+
+static int openShm(void){
+	const char *name = getenv("CS201_PROFILE_SHM");
+
+	/* the pass only pads the counter arrays to CS201_SHM_PAGE */
+	if(name == NULL || name[0] == '\0' || sysconf(_SC_PAGESIZE) > CS201_SHM_PAGE){
+		return 0;
+	}
+	shmFd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(shmFd < 0){
+		return 0;
+	}
+	shmHeader.magic = CS201_SHM_MAGIC;
+	shmHeader.version = CS201_PROFILE_VERSION;
+	shmHeader.numModules = 0;
+	shmSize = pageRound(sizeof(shmHeader));
+	return ftruncate(shmFd, shmSize) == 0 && pwrite(shmFd, &shmHeader, sizeof(shmHeader), 0) == (ssize_t)sizeof(shmHeader);
+}
+
+/* moves 'words' counters onto the object at 'offset': their values are copied there, then the object is mapped over
+ * their pages, so the instrumented code keeps counting at the same addresses */
+static int shareCounters(const uint64_t *counters, uint64_t words, uint64_t offset){
+	uint64_t size = pageRound(words * sizeof(uint64_t));
+	void *copy;
+
+	if(size == 0){
+		return 1;
+	}
+	if((uintptr_t)counters % CS201_SHM_PAGE != 0){
+		return 0;
+	}
+	copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, offset);
+	if(copy == MAP_FAILED){
+		return 0;
+	}
+	memcpy(copy, counters, words * sizeof(uint64_t));
+	munmap(copy, size);
+	return mmap((void *)counters, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, shmFd, offset) != MAP_FAILED;
+}
+
+/* appends a module to the object, it only shows up to readers once everything of it is in place */
+static void shareProfile(const struct cs201_profile_module *m){
+	const struct cs201_profile_header *header = (const struct cs201_profile_header *)m->metadata;
+	struct cs201_shm_module module;
+	uint64_t start;
+
+	if(shmFailed || (shmFd < 0 && !openShm())){
+		shmFailed = 1;
+		return;
+	}
+	start = shmSize;
+
+	module.counters = start + pageRound(sizeof(module) + m->metadataSize);
+	module.pathTables = module.counters + pageRound((uint64_t)m->numShards * m->shardStride * sizeof(uint64_t));
+	module.end = module.pathTables + pageRound((uint64_t)header->pathTableSize * sizeof(uint64_t));
+	module.metadataSize = m->metadataSize;
+	module.numShards = m->numShards;
+	module.shardStride = m->shardStride;
+	module.reserved = 0;
+
+	if(ftruncate(shmFd, module.end) != 0
+		|| pwrite(shmFd, &module, sizeof(module), start) != (ssize_t)sizeof(module)
+		|| pwrite(shmFd, m->metadata, m->metadataSize, start + sizeof(module)) != (ssize_t)m->metadataSize
+		|| !shareCounters(m->counters, (uint64_t)m->numShards * m->shardStride, module.counters)
+		|| !shareCounters(m->pathTables, header->pathTableSize, module.pathTables)){
+		shmFailed = 1;
+		return;
+	}
+	shmSize = module.end;
+	shmHeader.numModules++;
+	if(pwrite(shmFd, &shmHeader, sizeof(shmHeader), 0) != (ssize_t)sizeof(shmHeader)){
+		shmFailed = 1;
+	}
+}
+
+void __cs201_register_profile(const uint8_t *metadata, uint32_t metadataSize, const uint64_t *counters, uint32_t numShards, uint32_t shardStride, const uint64_t *pathTables){
+	if(numProfiles == 0){
+		atexit(dumpProfiles);
+	}
+	if(numProfiles < CS201_MAX_MODULES){
+		profiles[numProfiles].metadata = metadata;
+		profiles[numProfiles].metadataSize = metadataSize;
+		profiles[numProfiles].counters = counters;
+		profiles[numProfiles].numShards = numShards;
+		profiles[numProfiles].shardStride = shardStride;
+		profiles[numProfiles].pathTables = pathTables;
+		shareProfile(&profiles[numProfiles]);
+		numProfiles++;
+	}
+}
+
+/* threads are started through a trampoline so their counters get merged when the start routine returns */
+struct cs201_thread_start{
+	void *(*routine)(void *);
+	void *arg;
+};
+
+static void *threadStart(void *p){
+	struct cs201_thread_start start = *(struct cs201_thread_start *)p;
+	void *ret;
+
+	free(p);
+	ret = start.routine(start.arg);
+	runMerges();
+	return ret;
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*routine)(void *), void *arg){
+	static int (*real_create)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *) = NULL;
+	struct cs201_thread_start *start;
+	int ret;
+
+	if(real_create == NULL){
+		*(void **)&real_create = dlsym(RTLD_NEXT, "pthread_create");
+	}
+
+	start = malloc(sizeof(*start));
+	if(start == NULL){
+		return real_create(thread, attr, routine, arg);
+	}
+	start->routine = routine;
+	start->arg = arg;
+
+	ret = real_create(thread, attr, threadStart, start);
+	if(ret != 0){
+		free(start);
+	}
+	return ret;
+}
+
+void pthread_exit(void *retval){
+	static void (*real_exit)(void *) = NULL;
+
+	if(real_exit == NULL){
+		*(void **)&real_exit = dlsym(RTLD_NEXT, "pthread_exit");
+	}
+
+	runMerges();
+	real_exit(retval);
+	__builtin_unreachable();
+}
@@ -0,0 +1,129 @@
+/*
+ * Authors: Aaron Sanders (email: asand017@ucr.edu), Alvin Thai (email: athai005@ucr.edu)
+ *
+ * CS201 --- prints a binary profile written by CS201ProfileRuntime.c in the text format of the
+ * edge and path profiles. Edge counts that were not counted are recovered from flow conservation;
+ * with -path-profiling-edges=validate they are checked against full instrumentation (exit status 2
+ * if any differs):
+ *
+ *   c++ CS201ProfileTool.cpp -o cs201-profile -lrt
+ *   cs201-profile [cs201.prof]
+ *   cs201-profile --shm /name              live counters of a running program ($CS201_PROFILE_SHM)
+ */
+
+#include "CS201ProfileReader.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//CS201 Helper Function - prints the module record at 'pos', returns the position of the next one (0 on a malformed record)
+//'valid' is cleared if a recovered edge count differs from its validation counter
+static size_t printModule(const vector<char> &data, size_t pos, bool &valid){
+	CS201ProfileModule m;
+	string error;
+	size_t end = readProfileModule(data, pos, m, error);
+	if(end == 0){
+		cerr << "cs201-profile: " << error << "\n";
+		return 0;
+	}
+
+	bool printedEdges = false;
+	unsigned int checked = 0, mismatched = 0;
+	for(uint32_t f = 0; f < m.functions.size(); f++){
+		const cs201_profile_function &function = m.functions[f];
+		vector<int64_t> value;
+		vector<bool> known;
+		recoverEdgeCounts(function, m.edges.data() + function.firstEdge, m.count, value, known);
+
+		for(uint32_t e = 0; e < function.numEdges; e++){
+			const cs201_profile_edge &edge = m.edges[function.firstEdge + e];
+			if(edge.name == CS201_PROFILE_NONE)
+				continue;
+
+			string label = m.nameAt(edge.name);
+			if(!printedEdges)
+				cout << "EDGE PROFILING:\n";
+			printedEdges = true;
+			if(known[e])
+				cout << label << ": " << value[e] << "\n";
+			else
+				cout << label << ": ?\n";
+
+			if(edge.check != CS201_PROFILE_NONE){
+				checked++;
+				if(!known[e] || value[e] != (int64_t)m.count[edge.check]){
+					mismatched++;
+					cerr << "cs201-profile: " << m.nameAt(function.name) << ": " << label << " recovered as "
+						 << (known[e] ? to_string(value[e]) : string("?")) << ", counted " << m.count[edge.check] << "\n";
+				}
+			}
+		}
+	}
+	if(printedEdges)
+		cout << "\n";
+	if(checked != 0){
+		cout << "EDGE VALIDATION: " << (checked - mismatched) << " of " << checked << " recovered edge counts match\n\n";
+		if(mismatched != 0)
+			valid = false;
+	}
+
+	bool printedPaths = false;
+	for(uint32_t f = 0; f < m.functions.size(); f++){
+		const cs201_profile_function &function = m.functions[f];
+		if(function.numPaths == 0)
+			continue;
+
+		if(!printedPaths)
+			cout << "PATH PROFILING:\n";
+		printedPaths = true;
+		string name = m.nameAt(function.name);
+		if(function.pathTable == CS201_PROFILE_NONE){
+			for(uint64_t p = 0; p < function.numPaths; p++){
+				cout << "Path_" << name << "_" << p << ": " << m.count[function.counterBase + p] << "\n";
+			}
+			continue;
+		}
+
+		//too many paths to list, only the ones in the path table were taken
+		vector<pair<uint64_t, uint64_t> > taken;
+		uint64_t lost;
+		takenPaths(m, function, taken, lost);
+		sort(taken.begin(), taken.end());
+		for(size_t i = 0; i < taken.size(); i++){
+			cout << "Path_" << name << "_" << taken[i].first << ": " << taken[i].second << "\n";
+		}
+		if(lost != 0)
+			cout << "Path_" << name << "_other: " << lost << "\n";
+	}
+	return end;
+}
+
+int main(int argc, char **argv){
+	vector<char> data;
+	if(argc > 2 && string(argv[1]) == "--shm"){
+		string error;
+		if(!readShmProfile(argv[2], data, error)){
+			cerr << "cs201-profile: " << error << "\n";
+			return 1;
+		}
+	}else{
+		const char *path = (argc > 1) ? argv[1] : "cs201.prof";
+		if(!readProfileFile(path, data)){
+			cerr << "cs201-profile: can not read " << path << "\n";
+			return 1;
+		}
+	}
+
+	//one record per instrumented module
+	size_t pos = 0;
+	bool valid = true;
+	while(pos < data.size()){
+		pos = printModule(data, pos, valid);
+		if(pos == 0)
+			return 1;
+	}
+	return valid ? 0 : 2;
+}